@@ -0,0 +1,164 @@
+// Job queue contention: the mutex/condvar ring the pool used to hand jobs to
+// its workers, against the lock-free job_ring, first as bare queues and then
+// behind the thread pool (pool_queue "mutex" vs "mpmc"). Run with
+// `make bench && ./build/bench_job_queue`.
+
+#include "job_ring.h"
+#include "thread_pool.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// The old queue: a ring behind one mutex, with condition variables for
+// "not empty" and "not full".
+struct LockedQueue {
+    tp_job_t *jobs;
+    size_t capacity;
+    size_t head = 0;
+    size_t tail = 0;
+    size_t size = 0;
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t cond_jobs = PTHREAD_COND_INITIALIZER;
+    pthread_cond_t cond_space = PTHREAD_COND_INITIALIZER;
+
+    explicit LockedQueue(size_t cap)
+        : jobs(static_cast<tp_job_t *>(std::calloc(cap, sizeof(tp_job_t)))), capacity(cap) {}
+    ~LockedQueue() { std::free(jobs); }
+
+    void push(tp_job_t job) {
+        pthread_mutex_lock(&mutex);
+        while (size == capacity) pthread_cond_wait(&cond_space, &mutex);
+        jobs[tail] = job;
+        tail = (tail + 1) % capacity;
+        size++;
+        pthread_cond_signal(&cond_jobs);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    tp_job_t pop() {
+        pthread_mutex_lock(&mutex);
+        while (size == 0) pthread_cond_wait(&cond_jobs, &mutex);
+        tp_job_t job = jobs[head];
+        head = (head + 1) % capacity;
+        size--;
+        pthread_cond_signal(&cond_space);
+        pthread_mutex_unlock(&mutex);
+        return job;
+    }
+};
+
+struct RingQueue {
+    job_ring_t ring;
+
+    explicit RingQueue(size_t cap) { job_ring_init(&ring, cap); }
+    ~RingQueue() { job_ring_destroy(&ring); }
+
+    void push(tp_job_t job) {
+        while (job_ring_push(&ring, job) != 0) sched_yield();
+    }
+
+    tp_job_t pop() {
+        tp_job_t job;
+        while (job_ring_pop(&ring, &job) != 0) sched_yield();
+        return job;
+    }
+};
+
+double now_s() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Every thread pushes a job and pops one, `total / threads` times. Returns
+// nanoseconds per push+pop pair.
+template <typename Queue>
+double run_queue(size_t threads, size_t total) {
+    Queue q(1024);
+    const size_t per_thread = total / threads;
+    std::atomic<bool> go{false};
+    std::vector<std::thread> pool;
+    for (size_t t = 0; t < threads; ++t) {
+        pool.emplace_back([&, t] {
+            while (!go.load(std::memory_order_acquire)) sched_yield();
+            tp_job_t job{nullptr, reinterpret_cast<void *>(t), TP_CLASS_INTERACTIVE};
+            for (size_t i = 0; i < per_thread; ++i) {
+                q.push(job);
+                job = q.pop();
+            }
+        });
+    }
+    double start = now_s();
+    go.store(true, std::memory_order_release);
+    for (auto &th : pool) th.join();
+    return (now_s() - start) * 1e9 / static_cast<double>(per_thread * threads);
+}
+
+std::atomic<size_t> jobs_done{0};
+
+void count_job(void *) {
+    jobs_done.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Four submitters feed `total` empty jobs to a pool of `workers` threads.
+// Returns nanoseconds per job.
+double run_pool(tp_queue_t kind, size_t workers, size_t total) {
+    thread_pool_config_t cfg{};
+    cfg.thread_count = workers;
+    cfg.queue_capacity = workers * 4;
+    cfg.queue = kind;
+    thread_pool_t *pool = thread_pool_create(&cfg);
+    if (!pool) {
+        std::perror("thread_pool_create");
+        std::exit(1);
+    }
+    const size_t submitters = 4;
+    const size_t per_submitter = total / submitters;
+    jobs_done.store(0);
+    double start = now_s();
+    std::vector<std::thread> threads;
+    for (size_t s = 0; s < submitters; ++s) {
+        threads.emplace_back([&] {
+            tp_job_t job{count_job, nullptr, TP_CLASS_INTERACTIVE};
+            for (size_t i = 0; i < per_submitter; ++i) {
+                while (thread_pool_try_submit(pool, job) != 0) sched_yield();
+            }
+        });
+    }
+    for (auto &th : threads) th.join();
+    while (jobs_done.load(std::memory_order_relaxed) < per_submitter * submitters) sched_yield();
+    double elapsed = now_s() - start;
+    thread_pool_destroy(pool);
+    return elapsed * 1e9 / static_cast<double>(per_submitter * submitters);
+}
+
+} // namespace
+
+int main() {
+    const size_t thread_counts[] = {1, 4, 16, 64};
+    std::printf("cpus: %u\n\n", std::thread::hardware_concurrency());
+
+    std::printf("bare queue, every thread pushes then pops (ns per pair)\n");
+    std::printf("%8s %14s %14s %8s\n", "threads", "mutex+cond", "mpmc ring", "speedup");
+    for (size_t threads : thread_counts) {
+        double locked = run_queue<LockedQueue>(threads, 2000000);
+        double ring = run_queue<RingQueue>(threads, 2000000);
+        std::printf("%8zu %14.1f %14.1f %7.2fx\n", threads, locked, ring, locked / ring);
+    }
+
+    std::printf("\nthread pool, 4 submitters, empty jobs (ns per job)\n");
+    std::printf("%8s %14s %14s %8s\n", "workers", "mutex", "mpmc", "speedup");
+    for (size_t workers : thread_counts) {
+        double locked = run_pool(TP_QUEUE_MUTEX, workers, 1000000);
+        double ring = run_pool(TP_QUEUE_MPMC, workers, 1000000);
+        std::printf("%8zu %14.1f %14.1f %7.2fx\n", workers, locked, ring, locked / ring);
+    }
+    return 0;
+}
@@ -8,6 +8,9 @@
 extern "C" {
 #endif
 
+// Capacity an empty (never attached) buffer grows to on its first write.
+#define BUFFER_MIN_CAPACITY 4096
+
 typedef struct byte_buffer {
     char *data;
     size_t capacity;
@@ -20,7 +23,10 @@ void buffer_reset(byte_buffer_t *buf);
 void buffer_free(byte_buffer_t *buf);
 size_t buffer_readable(const byte_buffer_t *buf);
 size_t buffer_writable(const byte_buffer_t *buf);
-ssize_t buffer_fill_from_fd(byte_buffer_t *buf, int fd);
+// Reads once into the free tail. A full buffer is compacted first and only
+// grown while below max_capacity (0 = unlimited); past it the call fails
+// with ENOBUFS.
+ssize_t buffer_fill_from_fd(byte_buffer_t *buf, int fd, size_t max_capacity);
 ssize_t buffer_flush_to_fd(byte_buffer_t *buf, int fd);
 int buffer_append(byte_buffer_t *buf, const char *data, size_t len);
 const char *buffer_peek(const byte_buffer_t *buf);
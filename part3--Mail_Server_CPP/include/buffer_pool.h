@@ -0,0 +1,46 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+#include "buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Size-classed free lists of I/O buffers, owned by one reactor thread.
+// Connections attach a buffer only while they have bytes to read or write
+// and hand it back once it is empty, so an idle keep-alive connection holds
+// no buffer memory. Classes are powers of two, which is also what
+// buffer_append and buffer_fill_from_fd grow by, so a grown buffer still
+// lands in a class; anything beyond the largest class is freed on release.
+
+#define BUFFER_POOL_MIN_SHIFT 12 // 4 KB
+#define BUFFER_POOL_CLASSES 6    // 4 KB .. 128 KB
+#define BUFFER_POOL_CACHE_MAX 64 // idle buffers kept per class
+
+typedef struct buffer_pool_block {
+    struct buffer_pool_block *next;
+} buffer_pool_block_t;
+
+typedef struct buffer_pool {
+    buffer_pool_block_t *free_list[BUFFER_POOL_CLASSES];
+    size_t cached[BUFFER_POOL_CLASSES];
+} buffer_pool_t;
+
+void buffer_pool_init(buffer_pool_t *pool);
+void buffer_pool_destroy(buffer_pool_t *pool);
+// Gives buf (which must hold no memory) a buffer of at least min_cap bytes.
+// A NULL pool falls back to plain malloc. Returns 0 when buf already has one.
+int buffer_pool_attach(buffer_pool_t *pool, byte_buffer_t *buf, size_t min_cap);
+// Returns buf's memory to the pool; its contents are discarded.
+void buffer_pool_release(buffer_pool_t *pool, byte_buffer_t *buf);
+// Releases buf if it is empty, otherwise moves what it holds into the
+// smallest class of at least min_cap that fits, if that is smaller.
+void buffer_pool_trim(buffer_pool_t *pool, byte_buffer_t *buf, size_t min_cap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BUFFER_POOL_H
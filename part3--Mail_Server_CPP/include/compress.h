@@ -0,0 +1,50 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "http.h"
+
+#include <stddef.h>
+
+// Response compression with zlib. The coding is negotiated from
+// Accept-Encoding; bodies below min_size, of types that do not compress
+// (images, octet streams) or that would not shrink are sent as they are.
+// Bodies marked cacheable (static files, rendered templates) are compressed
+// once at the static level and served from a shared cache that keeps the plain
+// bytes next to the compressed ones and only answers when they match;
+// everything else is compressed on the worker that produced it.
+
+typedef enum {
+    CODING_IDENTITY,
+    CODING_GZIP,
+    CODING_DEFLATE
+} content_coding_t;
+
+typedef struct compressor compressor_t;
+
+typedef struct {
+    int level;          // dynamic bodies, 1..9; 0 disables compression
+    int static_level;   // cacheable bodies, compressed once
+    size_t min_size;    // smaller bodies are never compressed
+    size_t cache_bytes; // plain and compressed bytes kept for cacheable bodies
+} compress_config_t;
+
+compressor_t *compressor_create(const compress_config_t *cfg);
+void compressor_destroy(compressor_t *c);
+
+// Best coding the request accepts (q-values honoured, gzip on a tie).
+content_coding_t compress_negotiate(const http_request_t *req);
+// Replaces res->body with its compressed form and adds Content-Encoding when
+// that is worthwhile; compressible responses get Vary: Accept-Encoding either
+// way. Streamed (chunked) responses are left to compress_stream.
+void compress_response(compressor_t *c, http_response_t *res, content_coding_t coding);
+
+// Incremental encoder for a streamed response: begin adds the headers, each
+// call to compress_stream_chunk replaces res->body with the compressed bytes
+// so far (flushed, so the client can decode them at once), and `last`
+// finishes the stream. Returns NULL when the response should go out as is.
+typedef struct compress_stream compress_stream_t;
+compress_stream_t *compress_stream_begin(compressor_t *c, http_response_t *res, content_coding_t coding);
+int compress_stream_chunk(compress_stream_t *s, http_response_t *res, int last);
+void compress_stream_end(compress_stream_t *s);
+
+#endif // COMPRESS_H
@@ -13,6 +13,21 @@ enum class DbBackend {
     MySql
 };
 
+enum class IoEngine {
+    Epoll,
+    IoUring
+};
+
+enum class PoolQueue {
+    Mutex,
+    Mpmc
+};
+
+enum class TenantKey {
+    User, // the session's user, the client address without a session
+    Ip
+};
+
 struct MysqlConfig {
     std::string host{"127.0.0.1"};
     std::uint16_t port{3306};
@@ -27,6 +42,77 @@ struct ServerConfig {
     std::uint16_t port{8085};
     std::size_t max_connections{64};
     std::size_t thread_pool_size{8};
+    std::size_t pool_queue_capacity{0}; // per class; 0 -> 4 * thread_pool_size
+    PoolQueue pool_queue{PoolQueue::Mutex}; // injection queue in front of the workers
+    // Workers kept for interactive requests, and the dequeue shares of the
+    // interactive, bulk and background classes on the others.
+    std::size_t pool_reserved_workers{1};
+    unsigned pool_weight_interactive{6};
+    unsigned pool_weight_bulk{3};
+    unsigned pool_weight_background{1};
+    // Backpressure: parsed requests wait on a per-reactor overflow list while
+    // the pool queue is full. Past overflow_limit, or once the estimated queue
+    // wait exceeds latency_budget_ms (0 = off), requests get an immediate 503
+    // with Retry-After: retry_after_s.
+    std::size_t overflow_limit{256};
+    std::uint32_t latency_budget_ms{0};
+    std::uint32_t retry_after_s{1};
+    // Fairness between tenants (users or client addresses): one may have at
+    // most tenant_max_inflight jobs in the pool (0 -> half the pool) and
+    // tenant_queue_limit waiting in front of it; waiting tenants are served
+    // round robin with tenant_quantum_us of worker time per turn.
+    TenantKey tenant_key{TenantKey::User};
+    std::uint32_t tenant_max_inflight{0};
+    std::size_t tenant_queue_limit{64};
+    std::uint32_t tenant_quantum_us{1000};
+    std::size_t reactor_count{1}; // 0 -> one reactor per online CPU
+    std::size_t response_ring_size{1024}; // per reactor, worker -> reactor
+    IoEngine io_engine{IoEngine::Epoll};
+    // Connection timeouts, 0 disables. Header time counts from the first byte
+    // of a request, idle and write-stall time from the last progress.
+    std::uint32_t idle_timeout_ms{60000};
+    std::uint32_t header_timeout_ms{15000};
+    std::uint32_t write_timeout_ms{30000};
+    std::uint32_t timer_tick_ms{100};
+    // Per-connection read budget for one loop turn; a socket that still has
+    // data afterwards waits on the reactor's ready-list behind other clients.
+    std::size_t read_budget_bytes{256 * 1024};
+    std::uint32_t read_budget_reads{16};
+    // Requests per connection that may be in flight at once (1..16).
+    std::uint32_t pipeline_depth{8};
+    // No further requests of a connection are read or parsed while more than
+    // this many response bytes wait for its socket.
+    std::size_t max_output_bytes{256 * 1024};
+    // Let a worker write its response to the socket itself when the reactor
+    // has nothing queued for that connection.
+    bool direct_writes{false};
+    // A header block longer than max_header_bytes is refused with 431 (0 =
+    // unlimited); the read buffer never grows past it plus one 64 KB chunk.
+    std::size_t max_header_bytes{64 * 1024};
+    // Request bodies: Content-Length above max_body_bytes is refused with 413
+    // before any of the body is read (0 = unlimited); bodies above
+    // body_spool_threshold are written to an unlinked file in spool_dir as
+    // they arrive (0 = keep every body in memory).
+    std::size_t max_body_bytes{32 * 1024 * 1024};
+    std::size_t body_spool_threshold{1024 * 1024};
+    std::filesystem::path spool_dir{"/tmp"};
+    // Streamed responses: handlers hand off a chunk every stream_chunk_bytes
+    // and wait while more than stream_window_bytes of theirs are unsent. A
+    // wait holds a pool worker, so it lasts at most stream_wait_ms and at
+    // most stream_max_waiting workers (0 -> half the pool) wait at once; a
+    // part that cannot wait is queued anyway, and after a timed-out wait the
+    // rest of the stream is.
+    std::size_t stream_chunk_bytes{16 * 1024};
+    std::size_t stream_window_bytes{256 * 1024};
+    std::uint32_t stream_wait_ms{2000};
+    std::uint32_t stream_max_waiting{0};
+    // Response compression (gzip/deflate by Accept-Encoding). Level 0 turns
+    // it off; static files and templates are compressed once at
+    // compression_static_level and cached up to compression_cache_bytes.
+    int compression_level{6};
+    int compression_static_level{9};
+    std::size_t compression_min_bytes{1024};
+    std::size_t compression_cache_bytes{8 * 1024 * 1024};
     std::filesystem::path static_dir{"static"};
     std::filesystem::path template_dir{"templates"};
     std::filesystem::path data_dir{"data"};
@@ -0,0 +1,76 @@
+#ifndef CONN_TOKEN_H
+#define CONN_TOKEN_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Reference-counted state shared by a connection and every task it has
+// handed to the thread pool. The reactor cancels it when the client goes
+// away, so a queued task can skip work whose response nobody will read.
+//
+// It also carries the write gate that decides who may write to the socket:
+//   REACTOR  the reactor owns the write side (initial state)
+//   OPEN     the worker producing response `seq` may claim it
+//   WORKER   that worker is writing
+//   CLOSED   the connection is gone; a worker that still held the gate owns
+//            the fd and closes it
+// Only the reactor moves REACTOR -> OPEN, only the worker for `seq` moves
+// OPEN -> WORKER -> REACTOR, so at most one thread writes at any time.
+//
+// A worker streaming a response counts the bytes it hands to the reactor in
+// stream_backlog and the reactor takes them off once they are written. While
+// its response is the one being written (head_seq) and the backlog is over
+// the window, the worker sleeps on stream_wake, for a bounded time only.
+enum {
+    CONN_GATE_REACTOR = 0,
+    CONN_GATE_OPEN = 1,
+    CONN_GATE_WORKER = 2,
+    CONN_GATE_CLOSED = 3
+};
+
+typedef struct conn_token {
+    uint32_t refs;
+    uint32_t cancelled;
+    uint64_t write_gate; // (seq << 2) | CONN_GATE_*
+    uint32_t head_seq;   // response the reactor is writing
+    uint32_t stream_wake; // futex word, bumped on progress and on cancel
+    uint64_t stream_backlog;
+} conn_token_t;
+
+conn_token_t *conn_token_new(void);
+conn_token_t *conn_token_ref(conn_token_t *t);
+void conn_token_unref(conn_token_t *t);
+void conn_token_cancel(conn_token_t *t);
+int conn_token_cancelled(const conn_token_t *t);
+
+// Reactor side. open_writes requires that the reactor owns the gate;
+// reclaim_writes takes an unclaimed gate back and fails while a worker holds
+// it; close_writes returns 1 when the caller still owns (and must close) the
+// fd.
+void conn_token_open_writes(conn_token_t *t, uint32_t seq);
+int conn_token_reclaim_writes(conn_token_t *t);
+int conn_token_close_writes(conn_token_t *t);
+// Worker side. release_writes returns 0 when the connection was closed in the
+// meantime, leaving the fd to the caller.
+int conn_token_claim_writes(conn_token_t *t, uint32_t seq);
+int conn_token_release_writes(conn_token_t *t);
+
+// Streaming. The reactor publishes the response at the head of the pipeline
+// and returns written bytes; the worker adds what it posts and waits for room.
+void conn_token_set_head(conn_token_t *t, uint32_t seq);
+void conn_token_stream_written(conn_token_t *t, uint64_t bytes);
+void conn_token_stream_posted(conn_token_t *t, uint64_t bytes);
+// Blocks while response `seq` is being written and more than `window` bytes
+// of it are still unsent, for at most timeout_ms (0 = only check). Returns 0
+// once there is room, 1 when the time ran out and -1 once the connection is
+// gone.
+int conn_token_stream_wait(conn_token_t *t, uint32_t seq, uint64_t window, uint32_t timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CONN_TOKEN_H
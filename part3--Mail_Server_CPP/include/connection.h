@@ -4,12 +4,28 @@
 #include <stdint.h>
 #include <sys/epoll.h>
 #include "buffer.h"
+#include "buffer_pool.h"
+#include "out_queue.h"
 #include "http_parser.h"
 #include "http.h"
+#include "timer_wheel.h"
+#include "conn_token.h"
 
 #define READ_BUFFER_SIZE 16384
-#define WRITE_BUFFER_SIZE 32768
+// Bytes read ahead of the parser past a full header block; each batch is
+// moved into the request body (or its spool file) before more is read.
+#define READ_BODY_CHUNK 65536
+#define WRITE_BUFFER_SIZE 4096 // staging for header blocks, see out_queue.h
+#define CONN_PIPELINE_MAX 16 // upper bound for ServerConfig::pipeline_depth
 
+// Connection ids pair the fd with a per-reactor generation, so work finishing
+// after a close can never be mistaken for the connection that reused the fd.
+#define CONN_ID(fd, gen) (((uint64_t)(uint32_t)(gen) << 32) | (uint32_t)(fd))
+#define CONN_ID_FD(id) ((int)(uint32_t)(id))
+
+// Input is parsed in every state but CLOSING. READING means nothing is in
+// flight, PROCESSING that workers still owe responses, WRITING that `out` holds
+// output.
 typedef enum {
     CONN_STATE_READING,
     CONN_STATE_PROCESSING,
@@ -19,20 +35,69 @@ typedef enum {
 
 typedef struct connection {
     int fd;
+    uint64_t id;
+    uint64_t peer_key; // hash of the client address (no port): tenant without a session
+    // Tenant resolved for the last Authorization value seen, so the shared
+    // session table is consulted once per connection and token.
+    uint64_t auth_hash; // FNV-1a of that value, 0 = none resolved yet
+    uint64_t auth_tenant;
+    conn_token_t *token; // cancelled once the connection is being closed
     conn_state_t state;
-    byte_buffer_t read_buf;
-    byte_buffer_t write_buf;
+    buffer_pool_t *pool; // reactor-owned; read_buf and out's staging come from it
+    byte_buffer_t read_buf; // attached only while it holds input
+    out_queue_t out;
     http_parser_t parser;
-    http_response_t response;
+    // Pipelining: requests get consecutive sequence numbers as they are
+    // dispatched and responses leave in that order. A response that finishes
+    // early parks in reorder[seq % CONN_PIPELINE_MAX] (a worker_response_t).
+    uint32_t next_seq;
+    uint32_t write_seq;
+    void *reorder[CONN_PIPELINE_MAX];
+    int input_closed; // a Connection: close or malformed request was seen
+    int read_stalled; // epoll: input left in the socket while the pipeline or output was full
+    int writes_offered; // the token's write gate is open for write_seq
+    int continue_pending; // owe the request being read a 100 Continue
+    uint32_t stream_part; // next part of the streamed response at write_seq
+    uint64_t stream_unsent; // streamed bytes staged but not yet written
+    int in_batch; // collected in the current batch of worker responses
     long long last_activity_ms;
+    long long request_start_ms; // first byte of a partially read request, else 0
+    timer_node_t timer;
+    struct connection *lru_prev;
+    struct connection *lru_next;
+    struct connection *ready_next; // reactor ready-list: socket not yet drained
+    int in_ready;
     int registered_events;
     int keep_alive;
 } connection_t;
 
-int connection_init(connection_t *c, int fd);
+int connection_init(connection_t *c, int fd, uint64_t id, buffer_pool_t *pool,
+                    const http_body_limits_t *limits);
 void connection_free(connection_t *c);
-int connection_handle_read(connection_t *c);
+// Edge-triggered read: drains the socket until EAGAIN or until max_bytes /
+// max_reads is used up. Returns -1 on error or peer close, 0 once drained and
+// 1 when the budget ran out with data possibly still pending.
+int connection_handle_read(connection_t *c, size_t max_bytes, unsigned max_reads);
 int connection_handle_write(connection_t *c);
-void connection_prepare_response(connection_t *c, const http_response_t *res);
+// Serializes the status line and headers (everything before the body).
+void connection_serialize_head(byte_buffer_t *out, const http_response_t *res);
+// Queues a response behind any unsent output. The body moves into the
+// output queue (res->body is NULL afterwards) unless it is small enough to
+// copy.
+void connection_prepare_response(connection_t *c, http_response_t *res);
+// Queues the body of a later part of a chunked response as one chunk, and
+// the terminating zero-size chunk when it is the last part.
+void connection_append_chunk(connection_t *c, http_response_t *res, int last);
+// Queues bytes that are already serialized; `owned` (may be NULL) is freed
+// once they are sent, otherwise data must outlive the connection's output.
+void connection_append_raw(connection_t *c, char *owned, const char *data, size_t len);
+uint32_t connection_inflight(const connection_t *c);
+// Returns an empty read buffer to the pool, or shrinks an oversized one that
+// holds only the start of the next request. Output buffers go back on their
+// own once written.
+void connection_release_buffers(connection_t *c);
+// Most bytes read_buf may hold: the header limit plus one body chunk
+// (0 = unlimited).
+size_t connection_read_limit(const connection_t *c);
 
 #endif // CONNECTION_H
@@ -0,0 +1,109 @@
+#ifndef FAIR_QUEUE_H
+#define FAIR_QUEUE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+namespace mail {
+
+struct WorkerTask;
+
+// Whoever a request is accounted to: the session's user, or the client
+// address for requests without one. Shared by all reactors; a tenant lives
+// as long as some task refers to it.
+struct Tenant {
+    std::uint64_t key{0};
+    std::uint32_t refs{0};     // guarded by the table shard's lock
+    std::uint32_t inflight{0}; // jobs in the pool, queued or running (atomic)
+    std::uint32_t waiting{0};  // jobs parked in front of the pool on any reactor (atomic)
+    std::uint64_t avg_job_ns{0}; // EWMA (1/8) of the worker time its jobs took (atomic)
+};
+
+class TenantTable {
+public:
+    TenantTable() = default;
+    ~TenantTable();
+
+    TenantTable(const TenantTable &) = delete;
+    TenantTable &operator=(const TenantTable &) = delete;
+
+    // Returns the tenant for key with a reference taken; never fails.
+    Tenant *acquire(std::uint64_t key);
+    void release(Tenant *tenant);
+
+private:
+    static constexpr std::size_t kShards = 16;
+    struct Shard {
+        std::mutex lock;
+        std::unordered_map<std::uint64_t, Tenant *> tenants;
+    };
+    Shard shards_[kShards];
+};
+
+// Claims one of the tenant's max_inflight pool slots; fails when all are taken.
+bool tenant_enter(Tenant *tenant, std::uint32_t max_inflight);
+void tenant_leave(Tenant *tenant);
+// Takes a slot back after tenant_leave, whatever the limit: a job that let
+// go of its slot while it waited on the client resumes.
+void tenant_rejoin(Tenant *tenant);
+// A job of the tenant finished after `ns` of worker time; frees its slot.
+void tenant_job_done(Tenant *tenant, std::uint64_t ns);
+
+// Outcome of handing one task to the pool (FairQueue::drain).
+enum class FairSubmit {
+    Sent,    // in the pool
+    Dropped, // not needed any more (its client is gone); deleted by drain
+    Full     // no room in the pool; the task stays first in line
+};
+
+// Tasks waiting in front of the pool, one FIFO flow per tenant, served by
+// deficit round robin on worker time: each turn credits a flow `quantum_ns`,
+// and every job it sends is charged its tenant's average job time. A tenant
+// whose requests are expensive therefore gets fewer of them through per
+// round, and one with max_inflight jobs in the pool is skipped until one of
+// them finishes. Owned by one reactor; tasks are linked through
+// WorkerTask::next.
+class FairQueue {
+public:
+    FairQueue() = default;
+    ~FairQueue();
+
+    FairQueue(const FairQueue &) = delete;
+    FairQueue &operator=(const FairQueue &) = delete;
+
+    void push(WorkerTask *task);
+    // Removes any task, for teardown; nullptr once empty.
+    WorkerTask *pop();
+    std::size_t size() const noexcept { return size_; }
+    bool empty() const noexcept { return size_ == 0; }
+
+    using SubmitFn = FairSubmit (*)(void *ctx, WorkerTask *task);
+    // Sends tasks until the pool is full or every waiting tenant is at its
+    // limit. Tenant slots are claimed here; submit only hands the task over.
+    // Returns false when it stopped on a full pool.
+    bool drain(std::uint64_t quantum_ns, std::uint32_t max_inflight, SubmitFn submit, void *ctx);
+
+private:
+    struct Flow {
+        Tenant *tenant{nullptr};
+        WorkerTask *head{nullptr};
+        WorkerTask *tail{nullptr};
+        std::int64_t deficit_ns{0};
+        bool in_turn{false}; // credited for the turn it is in
+        Flow *next{nullptr}; // active ring, in service order
+    };
+
+    void unlink_front();
+    void rotate();
+
+    std::unordered_map<Tenant *, Flow> flows_; // only tenants with waiting tasks
+    Flow *active_head_{nullptr};
+    Flow *active_tail_{nullptr};
+    std::size_t size_{0};
+};
+
+} // namespace mail
+
+#endif // FAIR_QUEUE_H
@@ -2,6 +2,7 @@
 #define HTTP_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 typedef enum {
     HTTP_HEAD,
@@ -15,40 +16,141 @@ typedef enum {
 
 #define MAX_HEADERS 32
 
+// Headers the server itself looks at. The parser classifies them with a
+// perfect hash and stores them in fixed slots instead of the generic list.
+typedef enum {
+    HTTP_HDR_CONTENT_LENGTH,
+    HTTP_HDR_CONNECTION,
+    HTTP_HDR_AUTHORIZATION,
+    HTTP_HDR_CONTENT_TYPE,
+    HTTP_HDR_ACCEPT_ENCODING,
+    HTTP_HDR_IF_NONE_MATCH,
+    HTTP_HDR_RANGE,
+    HTTP_HDR_EXPECT,
+    HTTP_HDR_TRANSFER_ENCODING,
+    HTTP_HDR_HOST,
+    HTTP_HDR_KNOWN_COUNT,
+    HTTP_HDR_OTHER = HTTP_HDR_KNOWN_COUNT
+} http_header_id_t;
+
+// A request's arena is its header block exactly as received (request line
+// through the blank line), lifted out of the read buffer in one piece. The
+// parser tokenizes it in place: separators become NULs, so the path, the
+// version and every header name and value are C strings at fixed offsets,
+// and the index only records those offsets.
 typedef struct {
-    char name[64];
-    char value[256];
+    uint32_t name;
+    uint32_t value;
+    uint32_t name_len;
+    uint32_t value_len;
 } http_header_t;
 
+// A request body is held in memory, or spooled to an unlinked temp file (or
+// memfd) when it is large; http_request_body maps a spooled body on demand.
+typedef struct {
+    char *data;    // in-memory bytes, or the spool file once mapped
+    size_t length;
+    int fd;        // spool file, -1 when the body is in memory
+    int mapped;
+} http_body_t;
+
 typedef struct {
     http_method_t method;
-    char path[256];
-    char version[16];
-    http_header_t headers[MAX_HEADERS];
+    const char *path;    // into arena
+    const char *version; // into arena
+    char *arena;         // allocated together with the request
+    size_t arena_len;
+    uint32_t known[HTTP_HDR_KNOWN_COUNT]; // value offsets in arena, 0 if absent
+    http_header_t headers[MAX_HEADERS];   // all other headers
     size_t header_count;
     size_t content_length;
-    char *body;
+    http_body_t body;
 } http_request_t;
 
+// Precomputed header blocks: the server/CORS headers every response carries,
+// plus one Content-Type. Each is a ready-to-send "Name: value\r\n" run.
+typedef enum {
+    HTTP_HEADERS_COMMON, // no Content-Type
+    HTTP_HEADERS_JSON,
+    HTTP_HEADERS_HTML,
+    HTTP_HEADERS_CSS,
+    HTTP_HEADERS_JS,
+    HTTP_HEADERS_PNG,
+    HTTP_HEADERS_JPEG,
+    HTTP_HEADERS_SVG,
+    HTTP_HEADERS_GIF,
+    HTTP_HEADERS_OCTET,
+    HTTP_HEADERS_COUNT
+} http_header_set_t;
+
+typedef struct {
+    const char *data;
+    size_t len;
+} http_header_block_t;
+
+// "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n"
+#define HTTP_DATE_LINE_LEN 37
+
+struct http_stream;
+
 typedef struct {
     int status_code;
     char status_text[64];
-    http_header_t headers[MAX_HEADERS];
-    size_t header_count;
+    const http_header_block_t *header_block; // sent before `extra_headers`, may be NULL
+    char *extra_headers; // serialized "Name: value\r\n" lines, owned
+    size_t extra_headers_len;
     char *body;
     size_t body_length;
+    size_t body_capacity; // bytes allocated at body by http_response_stream_write
+    int chunked; // framed with Transfer-Encoding: chunked, body is one chunk
+    int cacheable; // body depends only on static content (files, templates)
     int keep_alive;
+    struct http_stream *stream; // where a streamed body goes, may be NULL
 } http_response_t;
 
-int http_request_init(http_request_t *req);
-void http_request_reset(http_request_t *req);
-void http_request_free(http_request_t *req);
+// A handler that produces a large body piece by piece writes it through
+// http_response_stream_write. With a stream attached (the worker sets one up
+// for HTTP/1.1 requests), every flush_bytes of it are handed off as a chunk
+// while the handler carries on: the first flush takes the head along and
+// switches the response to chunked framing. A body that never reaches
+// flush_bytes goes out with Content-Length like any other.
+typedef struct http_stream {
+    // Takes res->body (and the head on the first call). Returns -1 when
+    // nobody will read the rest, so the handler can stop.
+    int (*flush)(struct http_stream *stream, http_response_t *res);
+    size_t flush_bytes;
+} http_stream_t;
+
+// Allocates a request with room for an arena of arena_len bytes (plus a NUL).
+http_request_t *http_request_new(size_t arena_len);
+void http_request_destroy(http_request_t *req);
+// The body as one NUL-terminated string, mapping a spooled body read-only on
+// first use. NULL when there is no body or it cannot be mapped.
+const char *http_request_body(http_request_t *req);
+const char *http_request_header_name(const http_request_t *req, size_t i);
+const char *http_request_header_value(const http_request_t *req, size_t i);
 
 int http_response_init(http_response_t *res);
 void http_response_reset(http_response_t *res);
 void http_response_free(http_response_t *res);
+// Appends to the body, flushing it to res->stream once it is large enough.
+// Returns -1 on allocation failure or when the client is gone.
+int http_response_stream_write(http_response_t *res, const char *data, size_t len);
 
+http_header_id_t http_header_classify(const char *name, size_t len);
+// Value of a well-known header, or NULL. O(1).
+const char *http_request_header(const http_request_t *req, http_header_id_t id);
+// Value of any header by name (case-insensitive), or NULL.
 const char *http_header_get(const http_request_t *req, const char *name);
+// Adds or replaces a header that is not part of the response's header block.
 void http_response_set_header(http_response_t *res, const char *name, const char *value);
+void http_response_use_headers(http_response_t *res, http_header_set_t set);
+// True when the header block names a textual type worth compressing.
+int http_response_compressible(const http_response_t *res);
+
+// Cached Date header line shared by all threads. Reactors refresh it once the
+// wall-clock second changes; readers get HTTP_DATE_LINE_LEN bytes.
+void http_date_refresh(long long now_ms);
+const char *http_date_line(void);
 
 #endif // HTTP_H
@@ -7,18 +7,51 @@
 typedef enum {
     PARSE_IN_PROGRESS,
     PARSE_COMPLETE,
-    PARSE_ERROR
+    PARSE_HEADERS,  // headers done, body still on its way; call again to go on
+    PARSE_ERROR,
+    PARSE_TOO_LARGE, // Content-Length over the limit; no body byte was read
+    PARSE_HEADER_TOO_LARGE // no end of the header block within max_header
 } parse_result_t;
 
+// Request size limits, shared by all connections of a server. Bodies above
+// spool_threshold are written to an unlinked file in spool_dir (or a memfd)
+// as they arrive instead of being held in memory.
 typedef struct {
-    http_request_t request;
+    size_t max_header;      // longest header block; 0 = unlimited
+    size_t max_body;        // 0 = unlimited
+    size_t spool_threshold; // 0 = never spool
+    const char *spool_dir;  // NULL or "" -> memfd
+} http_body_limits_t;
+
+// Where a chunked body decoder stands between calls.
+enum {
+    CHUNK_SIZE,     // expecting a size line
+    CHUNK_DATA,     // chunk_remaining bytes of data to go
+    CHUNK_DATA_END, // expecting the CRLF after the data
+    CHUNK_TRAILER   // skipping trailer fields up to the empty line
+};
+
+#define CHUNK_LINE_MAX 4096 // longest size or trailer line accepted
+
+typedef struct {
+    const http_body_limits_t *limits; // NULL = unlimited, in memory
+    http_request_t *request; // allocated once the header block is complete
     size_t header_bytes;
-    size_t body_received;
+    size_t scanned; // bytes of the header block already searched for its end
+    size_t body_received; // decoded body bytes so far
+    size_t body_capacity; // bytes allocated for an in-memory body
+    size_t chunk_remaining;
+    int chunk_state;
+    int chunked; // Transfer-Encoding: chunked
     int headers_complete;
 } http_parser_t;
 
-void http_parser_init(http_parser_t *parser);
+void http_parser_init(http_parser_t *parser, const http_body_limits_t *limits);
 void http_parser_reset(http_parser_t *parser);
+void http_parser_free(http_parser_t *parser);
+// Hands the completed request over to the caller; the parser starts a fresh
+// one with the next byte.
+http_request_t *http_parser_take_request(http_parser_t *parser);
 parse_result_t http_parser_execute(http_parser_t *parser, byte_buffer_t *read_buf);
 
 #endif // HTTP_PARSER_H
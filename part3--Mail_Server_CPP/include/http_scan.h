@@ -0,0 +1,28 @@
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Byte-scanning kernels for the HTTP parser. Both look for '\n' 16 (SSE2) or
+// 32 (AVX2) bytes at a time and only inspect the bytes around a hit; the
+// variant is picked once from the CPU's features, with a scalar fallback on
+// other architectures.
+
+// Offset of the first '\n' in data[0, len), or len if there is none.
+size_t http_scan_newline(const char *data, size_t len);
+// Offset just past the first "\r\n\r\n" in data[0, len), or 0 if there is
+// none. Scanning starts at `from`; bytes before it are known not to complete
+// a terminator on their own, so a caller can resume where it stopped.
+size_t http_scan_header_end(const char *data, size_t len, size_t from);
+// Name of the kernel in use ("avx2", "sse2" or "scalar").
+const char *http_scan_kernel(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HTTP_SCAN_H
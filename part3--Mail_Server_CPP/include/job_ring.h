@@ -0,0 +1,45 @@
+#ifndef JOB_RING_H
+#define JOB_RING_H
+
+#include "thread_pool.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bounded multi-producer / multi-consumer ring of pool jobs (Vyukov's
+// scheme). Every cell carries a sequence number that tells producers and
+// consumers whether it is free or filled for their lap, so both sides claim
+// a position with one CAS and never take a lock. Jobs are stored by value.
+
+typedef struct job_ring_cell {
+    uint64_t seq;
+    tp_job_t job;
+} job_ring_cell_t;
+
+typedef struct job_ring {
+    job_ring_cell_t *cells;
+    size_t mask;
+    uint64_t tail __attribute__((aligned(64))); // producers
+    uint64_t head __attribute__((aligned(64))); // consumers
+} job_ring_t;
+
+// Capacity is rounded up to a power of two.
+int job_ring_init(job_ring_t *r, size_t capacity);
+void job_ring_destroy(job_ring_t *r);
+// Returns -1 when the ring is full, or for a moment when the consumer of the
+// cell one lap back has claimed it but not yet released it.
+int job_ring_push(job_ring_t *r, tp_job_t job);
+// Returns -1 when the ring is empty.
+int job_ring_pop(job_ring_t *r, tp_job_t *out);
+// Jobs in the ring; only a snapshot while others push and pop.
+size_t job_ring_size(const job_ring_t *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // JOB_RING_H
@@ -3,15 +3,29 @@
 
 #include "http.h"
 #include "runtime.h"
+#include "conn_token.h"
+#include "mpsc_queue.h"
 
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 
 namespace mail {
 
 struct WorkerTask final {
     ServerRuntime *runtime{nullptr};
-    int fd{-1};
-    http_request_t request{};
+    Reactor *reactor{nullptr};
+    std::uint64_t conn_id{0};
+    std::uint32_t seq{0}; // position in the connection's pipeline
+    tp_class_t cls{TP_CLASS_INTERACTIVE}; // pool queue, from router_classify
+    Tenant *tenant{nullptr}; // owned reference; see fair_queue.h
+    // Worker time accounting: when the job started running (0 while it has
+    // not) and how long it since spent waiting on the client's stream window.
+    std::uint64_t started_ns{0};
+    std::uint64_t paused_ns{0};
+    conn_token_t *token{nullptr}; // owned reference, checked before running
+    WorkerTask *next{nullptr}; // reactor fair queue
+    http_request_t *request{nullptr}; // owned, taken from the connection's parser
 
     WorkerTask();
     ~WorkerTask();
@@ -22,9 +36,29 @@ struct WorkerTask final {
     WorkerTask &operator=(WorkerTask &&) = delete;
 };
 
-struct WorkerResponse final {
-    int fd{-1};
+// The mpsc_node base links the response into its reactor's overflow queue.
+struct WorkerResponse final : mpsc_node {
+    std::uint64_t conn_id{0};
+    std::uint32_t seq{0};
     http_response_t response{};
+    // Preserialized bytes sent verbatim instead of `response` (not owned).
+    const char *raw{nullptr};
+    std::size_t raw_len{0};
+    // Direct writes: the worker already sent the response (sent), or sent a
+    // prefix (wire). The rest is then wire_head (unsent header bytes, owned,
+    // may be null) followed by response.body from body_sent on.
+    bool sent{false};
+    bool wire{false};
+    char *wire_head{nullptr};
+    std::size_t wire_head_len{0};
+    std::size_t body_sent{0};
+    // Streamed responses arrive in parts: part 0 carries the head, later
+    // ones only body, and all but the last have `more` set. Parts that get
+    // ahead of the one being written wait in next_part order in the
+    // response's reorder slot.
+    std::uint32_t part{0};
+    bool more{false};
+    WorkerResponse *next_part{nullptr}; // owned
 
     WorkerResponse();
     ~WorkerResponse();
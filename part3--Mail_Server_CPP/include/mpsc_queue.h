@@ -0,0 +1,39 @@
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Unbounded intrusive multi-producer / single-consumer queue (Vyukov's
+// scheme). Items embed an mpsc_node_t, so pushing allocates nothing; a
+// producer links its node with one atomic exchange and never waits. The
+// consumer needs no atomic read-modify-write except to re-insert the stub
+// when it takes the last node. A producer that has swapped the head but not
+// yet linked its node makes the queue look non-empty while pop still returns
+// NULL; the consumer simply tries again later.
+
+typedef struct mpsc_node {
+    struct mpsc_node *next;
+} mpsc_node_t;
+
+typedef struct mpsc_queue {
+    mpsc_node_t *head __attribute__((aligned(64))); // producers
+    mpsc_node_t *tail __attribute__((aligned(64))); // consumer only
+    mpsc_node_t stub;
+} mpsc_queue_t;
+
+void mpsc_queue_init(mpsc_queue_t *q);
+void mpsc_queue_push(mpsc_queue_t *q, mpsc_node_t *node);
+// Consumer side.
+mpsc_node_t *mpsc_queue_pop(mpsc_queue_t *q);
+size_t mpsc_queue_pop_batch(mpsc_queue_t *q, mpsc_node_t **out, size_t max);
+int mpsc_queue_empty(const mpsc_queue_t *q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MPSC_QUEUE_H
@@ -0,0 +1,42 @@
+#ifndef MPSC_RING_H
+#define MPSC_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bounded multi-producer / single-consumer ring of pointers. Every cell
+// carries a sequence number (Vyukov's scheme), so producers claim slots with
+// one CAS on the tail and the consumer needs no atomic read-modify-write at
+// all. Head and tail live on separate cache lines.
+
+typedef struct mpsc_ring_cell {
+    uint64_t seq;
+    void *data;
+} mpsc_ring_cell_t;
+
+typedef struct mpsc_ring {
+    mpsc_ring_cell_t *cells;
+    size_t mask;
+    uint64_t tail __attribute__((aligned(64))); // producers
+    uint64_t head __attribute__((aligned(64))); // consumer only
+} mpsc_ring_t;
+
+// Capacity is rounded up to a power of two.
+int mpsc_ring_init(mpsc_ring_t *r, size_t capacity);
+void mpsc_ring_destroy(mpsc_ring_t *r, void (*free_fn)(void *));
+// Returns -1 when the ring is full.
+int mpsc_ring_push(mpsc_ring_t *r, void *data);
+// Consumer side.
+void *mpsc_ring_pop(mpsc_ring_t *r);
+size_t mpsc_ring_pop_batch(mpsc_ring_t *r, void **out, size_t max);
+int mpsc_ring_empty(const mpsc_ring_t *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MPSC_RING_H
@@ -0,0 +1,72 @@
+#ifndef OUT_QUEUE_H
+#define OUT_QUEUE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "buffer.h"
+#include "buffer_pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Ordered output of a connection as a list of segments, written with
+// writev. Header blocks and small bodies are copied into one staging buffer;
+// large bodies are queued by reference and, when owned, freed once sent. The
+// staging buffer may move when it grows, so segments in it are kept as
+// offsets and resolved only when an iovec is built. The staging buffer is
+// taken from a buffer pool on first use and returned once everything queued
+// has been written.
+
+#define OUT_QUEUE_COPY_MAX 1024 // bodies up to this size are copied, not referenced
+#define OUT_QUEUE_IOV_MAX 64
+
+typedef struct out_segment {
+    const char *data; // NULL: bytes live in staging at `offset`
+    size_t offset;
+    size_t len;
+    char *owned;      // freed once the segment is fully sent
+} out_segment_t;
+
+typedef struct out_queue {
+    buffer_pool_t *pool; // may be NULL
+    size_t staging_cap;
+    byte_buffer_t staging;
+    out_segment_t *segs;
+    size_t seg_cap;
+    size_t seg_head;   // first unsent segment
+    size_t seg_count;  // segments in use, including sent ones before seg_head
+    size_t head_sent;  // bytes of segs[seg_head] already written
+    size_t pending;    // unsent bytes in total
+} out_queue_t;
+
+void out_queue_init(out_queue_t *q, buffer_pool_t *pool, size_t staging_cap);
+void out_queue_free(out_queue_t *q);
+size_t out_queue_pending(const out_queue_t *q);
+int out_queue_append_copy(out_queue_t *q, const char *data, size_t len);
+// Staging buffer for serializing into directly, attached if needed (NULL if
+// that fails). Follow up with out_queue_commit_staged.
+byte_buffer_t *out_queue_staging(out_queue_t *q);
+// Queues what the caller serialized straight into staging since `offset`
+// (the staging write position it started from).
+int out_queue_commit_staged(out_queue_t *q, size_t offset);
+// Queues data[0, len) and frees `owned` once it has gone out.
+int out_queue_append_owned(out_queue_t *q, char *owned, const char *data, size_t len);
+// Queues bytes the caller keeps alive until they are sent.
+int out_queue_append_ref(out_queue_t *q, const char *data, size_t len);
+// Describes up to max unsent segments, the first one from its unsent offset.
+size_t out_queue_iov(const out_queue_t *q, struct iovec *iov, size_t max);
+// Marks n bytes as written, releasing finished segments.
+void out_queue_consume(out_queue_t *q, size_t n);
+// Gathered writes of up to OUT_QUEUE_IOV_MAX segments each (sendmsg with
+// MSG_NOSIGNAL, so a dead peer is an error rather than SIGPIPE), repeated
+// until the queue is empty or the socket takes less than it was offered:
+// under edge-triggered epoll only a full socket raises another EPOLLOUT.
+ssize_t out_queue_writev(out_queue_t *q, int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OUT_QUEUE_H
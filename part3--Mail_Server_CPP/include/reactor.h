@@ -0,0 +1,151 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "runtime.h"
+#include "connection.h"
+#include "jobs.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace mail {
+
+struct ConnectionDeleter {
+    void operator()(connection_t *conn) const noexcept {
+        if (conn) {
+            for (void *&slot : conn->reorder) {
+                worker_response_free(static_cast<worker_response_t *>(slot));
+                slot = nullptr;
+            }
+            connection_free(conn);
+            delete conn;
+        }
+    }
+};
+
+using ConnectionHandle = std::unique_ptr<connection_t, ConnectionDeleter>;
+
+class ConnectionTable {
+public:
+    explicit ConnectionTable(std::size_t initial_capacity)
+        : slots_(initial_capacity), count_(0) {}
+
+    connection_t *get(int fd) noexcept {
+        if (fd < 0) return nullptr;
+        const auto idx = static_cast<std::size_t>(fd);
+        if (idx >= slots_.size()) return nullptr;
+        return slots_[idx].get();
+    }
+
+    void insert(ConnectionHandle conn) {
+        const auto fd = static_cast<std::size_t>(conn->fd);
+        ensure_capacity(fd + 1);
+        if (!slots_[fd]) {
+            ++count_;
+        }
+        slots_[fd] = std::move(conn);
+    }
+
+    void erase(int fd) noexcept {
+        if (fd < 0) return;
+        const auto idx = static_cast<std::size_t>(fd);
+        if (idx >= slots_.size()) return;
+        if (slots_[idx]) {
+            slots_[idx].reset();
+            if (count_ > 0) {
+                --count_;
+            }
+        }
+    }
+
+    std::size_t size() const noexcept { return count_; }
+
+    void clear() noexcept {
+        for (auto &slot : slots_) {
+            slot.reset();
+        }
+        count_ = 0;
+    }
+
+private:
+    void ensure_capacity(std::size_t desired) {
+        if (desired <= slots_.size()) {
+            return;
+        }
+        std::size_t new_cap = slots_.empty() ? 1024 : slots_.size();
+        while (new_cap < desired) {
+            new_cap *= 2;
+        }
+        slots_.resize(new_cap);
+    }
+
+    std::vector<ConnectionHandle> slots_;
+    std::size_t count_;
+};
+
+inline ConnectionHandle make_connection(int fd, std::uint64_t id, buffer_pool_t *pool,
+                                        const http_body_limits_t *limits) {
+    auto conn = ConnectionHandle{new connection_t{}, ConnectionDeleter{}};
+    connection_init(conn.get(), fd, id, pool, limits);
+    return conn;
+}
+
+// Engine-independent pieces of the reactor (src/server.cpp).
+
+using ReactorCloseFn = void (*)(Reactor *r, ConnectionTable &table, int fd);
+
+// Registers a freshly accepted socket and, if the reactor is over its share of
+// max_connections, returns the fd of the least recently active connection to
+// drop (else -1).
+int reactor_adopt_connection(Reactor *r, ConnectionTable &table, int client_fd);
+// Parses every complete request in read_buf and dispatches each to the pool,
+// up to pipeline_depth in flight and while no more than max_output_bytes of
+// output are unsent. Errors are queued as in-order responses.
+// Hands the read buffer back to the reactor's pool once it is empty.
+void reactor_consume_input(Reactor *r, connection_t *conn);
+// Parks a worker response in its connection's reorder queue, taking
+// ownership. Returns the connection, or nullptr if the response is stale.
+connection_t *reactor_apply_response(Reactor *r, ConnectionTable &table, worker_response_t *resp);
+// Queues the responses that are next in request order on the connection's
+// output and switches to WRITING. Returns 1 when anything was staged. With
+// direct_writes it then offers the write side to the worker of the next
+// response; engines must only call it while none of the output is in flight.
+int reactor_flush_responses(Reactor *r, connection_t *conn);
+// True while the connection may take more input off the socket: its pipeline
+// has room, its output is below max_output_bytes and its read buffer is
+// below the header limit plus one body chunk.
+bool reactor_wants_input(Reactor *r, const connection_t *conn);
+// Records activity: moves the connection to the LRU tail and re-arms the
+// timeout that matches its current state.
+void reactor_touch(Reactor *r, connection_t *conn);
+// Detaches a connection that is being closed and cancels its queued work.
+void reactor_forget(Reactor *r, connection_t *conn);
+// Closes every connection whose timeout has passed and keeps the cached Date
+// header current.
+void reactor_expire_timers(Reactor *r, ConnectionTable &table, ReactorCloseFn close_fn);
+// epoll_wait-style timeout until the next timer is due.
+int reactor_next_timeout(Reactor *r);
+// Wake-up protocol around a blocking wait: prepare_wait arms the eventfd
+// signal and returns false if responses are already waiting, or if capacity
+// freed up since parked requests were last tried (do not block); end_wait
+// disarms it again once the loop is running.
+bool reactor_prepare_wait(Reactor *r);
+void reactor_end_wait(Reactor *r);
+// Pops up to max worker responses, ring first, then the overflow queue.
+std::size_t reactor_take_responses(Reactor *r, worker_response_t **out, std::size_t max);
+// Moves parked requests into the pool while it has room.
+void reactor_drain_overflow(Reactor *r);
+// Called by workers once a pool queue slot or a tenant slot is free: wakes
+// the reactors that sleep with parked requests.
+void reactor_capacity_freed(ServerRuntime *rt);
+
+// io_uring engine (src/uring_engine.cpp).
+int uring_engine_setup(Reactor *r);
+void uring_engine_run(Reactor *r, ConnectionTable &table);
+void uring_engine_teardown(Reactor *r);
+
+} // namespace mail
+
+#endif // REACTOR_H
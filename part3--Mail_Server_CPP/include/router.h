@@ -2,18 +2,38 @@
 #define ROUTER_H
 
 #include "http.h"
+#include "thread_pool.h"
+
+#include <cstdint>
 
 namespace mail {
 
 struct ServerRuntime;
 
+// The router fills in the caller's response (the worker's WorkerResponse), so
+// nothing is copied on the way back. Handlers that stream their body hand it
+// to `stream` in pieces when the caller provides one.
 struct RouterResult {
-    http_response_t response{};
+    http_response_t *response{nullptr};
+    http_stream_t *stream{nullptr};
 };
 
 void router_init(ServerRuntime *rt);
 void router_dispose();
 int router_handle_request(ServerRuntime *rt, http_request_t *req, RouterResult *out);
+// Cheap checks on the headers of a request whose body has not arrived yet:
+// unsupported expectations, routes that take no body and missing sessions.
+// Runs on the reactor, so it never touches the database and never renews a
+// session. Returns 0 to let the body in, or -1 with the final answer in res.
+int router_precheck(ServerRuntime *rt, const http_request_t *req, http_response_t *res);
+// Pool queue for a parsed request: composes and spooled uploads are bulk,
+// requests sent with a low RFC 9218 priority (u=5 or above) background,
+// everything else interactive.
+tp_class_t router_classify(const http_request_t *req);
+// User id of the request's bearer session, if it has a live one. Reads only
+// the in-memory session table (under its lock), so the reactor can key fair
+// queuing on it; it caches the answer per connection.
+int router_session_user(ServerRuntime *rt, const http_request_t *req, std::uint64_t *user_id);
 
 } // namespace mail
 
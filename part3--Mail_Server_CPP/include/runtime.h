@@ -3,44 +3,102 @@
 
 #include "config.h"
 #include "thread_pool.h"
-#include "concurrent_queue.h"
-#include "max_heap.h"
+#include "mpsc_ring.h"
+#include "mpsc_queue.h"
+#include "timer_wheel.h"
+#include "buffer_pool.h"
+#include "fair_queue.h"
 #include "http.h"
+#include "http_parser.h"
 #include "db.h"
 
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
+#include <string>
 
 struct auth_context;
+struct compressor;
+struct connection;
 struct mail_service;
 struct template_engine;
 
 namespace mail {
 
 class ConnectionTable;
+struct UringEngine;
+struct WorkerTask;
 
 struct ResponseJob {
     int fd{-1};
     http_response_t response{};
 };
 
-struct ServerRuntime {
-    ServerConfig config{};
+struct ServerRuntime;
+
+// One event loop. Every reactor owns its own SO_REUSEPORT listen socket, so
+// the kernel shards accepted connections across them and a connection never
+// leaves the reactor that accepted it.
+struct Reactor {
+    ServerRuntime *runtime{nullptr};
+    std::size_t index{0};
     int listen_fd{-1};
     int epoll_fd{-1};
     int event_fd{-1};
-    thread_pool_t *pool{nullptr};
-    concurrent_queue_t response_queue{};
-    max_heap_t connection_heap{};
+    // Worker -> reactor handoff. Responses go to the bounded ring; only when
+    // it is full are they linked into the intrusive overflow queue, which
+    // needs neither a lock nor an allocation. Workers write the eventfd only
+    // if wake_armed is set, i.e. the reactor is about to sleep.
+    mpsc_ring_t response_ring{};
+    mpsc_queue_t response_queue{};
+    std::uint32_t wake_armed{0};
+    // Set with wake_armed while tasks sit in `overflow`: workers then also
+    // wake the reactor when pool or tenant capacity frees up. overflow_epoch
+    // is the runtime's capacity_epoch as of the last drain.
+    std::uint32_t overflow_parked{0};
+    std::uint64_t overflow_epoch{0};
+    timer_wheel_t timers{};
+    buffer_pool_t buffers{}; // read and staging buffers of its connections
+    // Least recently active connection at the head; evicted first once the
+    // reactor is over max_connections.
+    connection *lru_head{nullptr};
+    connection *lru_tail{nullptr};
+    // Connections whose read budget ran out before EAGAIN (epoll engine).
+    connection *ready_head{nullptr};
+    connection *ready_tail{nullptr};
+    std::size_t max_connections{0};
+    std::uint32_t next_generation{0}; // high half of connection ids
+    // Parsed requests waiting for room in their class's pool queue, or for
+    // their tenant to get below tenant_max_inflight; overflow_count is the
+    // total over all classes.
+    FairQueue overflow[TP_CLASS_COUNT];
+    std::size_t overflow_count{0};
     ConnectionTable *connections{nullptr};
+    UringEngine *uring{nullptr}; // non-null when this reactor runs on io_uring
+};
+
+struct ServerRuntime {
+    ServerConfig config{};
+    thread_pool_t *pool{nullptr};
+    Reactor *reactors{nullptr};
+    std::size_t reactor_count{0};
     db_handle_t *db{nullptr};
     auth_context *auth{nullptr};
     mail_service *mail{nullptr};
     template_engine *templates{nullptr};
+    compressor *compression{nullptr};
+    TenantTable *tenants{nullptr};
+    std::string overload_response; // serialized 503, built once in server_run
+    std::string spool_dir;
+    http_body_limits_t body_limits{}; // shared by every connection's parser
+    std::atomic<std::uint32_t> stream_waiters{0}; // workers paused on a stream window
+    std::atomic<std::uint64_t> capacity_epoch{0}; // bumped whenever a pool or tenant slot frees
 };
 
 } // namespace mail
 
 using response_job_t = mail::ResponseJob;
 using server_runtime_t = mail::ServerRuntime;
+using reactor_t = mail::Reactor;
 
 #endif // RUNTIME_H
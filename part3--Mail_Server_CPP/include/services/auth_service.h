@@ -4,6 +4,7 @@
 #include "db.h"
 
 #include <stddef.h>
+#include <stdint.h>
 
 typedef struct auth_context auth_context_t;
 
@@ -13,6 +14,9 @@ int auth_service_login(auth_context_t *ctx, const char *username, const char *pa
                        char *token_out, size_t token_len, user_record_t *user_out);
 int auth_service_logout(auth_context_t *ctx, const char *token);
 int auth_service_validate(auth_context_t *ctx, const char *token, user_record_t *user_out);
+// The user a live session belongs to, from the in-memory session table only;
+// unlike validate it neither touches the database nor extends the session.
+int auth_service_session_user(auth_context_t *ctx, const char *token, uint64_t *user_id);
 int auth_service_register(auth_context_t *ctx, const char *username, const char *email, const char *password,
                           char *token_out, size_t token_len, user_record_t *user_out);
 
@@ -2,31 +2,62 @@
 #define THREAD_POOL_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include <pthread.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Request classes, each with its own queue. Interactive jobs (logins,
+// session checks, listings) must not wait behind bulk ones (composes with
+// attachments, large uploads); background jobs get what is left.
+typedef enum {
+    TP_CLASS_INTERACTIVE,
+    TP_CLASS_BULK,
+    TP_CLASS_BACKGROUND,
+    TP_CLASS_COUNT
+} tp_class_t;
+
 typedef struct tp_job {
     void (*fn)(void *arg);
     void *arg;
+    tp_class_t cls; // zero-initialized jobs are interactive
 } tp_job_t;
 
 typedef struct thread_pool thread_pool_t;
 
 typedef void (*tp_error_cb)(const char *msg);
 
+// How jobs submitted from outside the pool are queued for the workers.
+typedef enum {
+    TP_QUEUE_MUTEX, // ring buffer behind a mutex
+    TP_QUEUE_MPMC   // lock-free bounded ring (job_ring.h)
+} tp_queue_t;
+
 typedef struct thread_pool_config {
     size_t thread_count;
-    size_t queue_capacity;
+    size_t queue_capacity; // per class
+    tp_queue_t queue;
+    // Workers that only ever run interactive jobs (at most thread_count - 1).
+    size_t reserved;
+    // Share of dequeues each class gets from the other workers while every
+    // class has work queued; all zero means equal shares.
+    unsigned weights[TP_CLASS_COUNT];
     tp_error_cb on_error;
 } thread_pool_config_t;
 
 thread_pool_t *thread_pool_create(const thread_pool_config_t *cfg);
 void thread_pool_destroy(thread_pool_t *pool);
+// Blocks while the job's class queue is full.
 int thread_pool_submit(thread_pool_t *pool, tp_job_t job);
+// Never blocks: fails with errno EAGAIN when the job's class queue is full.
+int thread_pool_try_submit(thread_pool_t *pool, tp_job_t job);
 size_t thread_pool_size(const thread_pool_t *pool);
+// Expected time a job of class `cls` spends queued if submitted now behind
+// `ahead` more jobs of that class the caller still holds, from the class's
+// backlog and a moving average of its job run time.
+uint64_t thread_pool_wait_estimate_us(thread_pool_t *pool, tp_class_t cls, size_t ahead);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,57 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Two-level hierarchical timing wheel. Timers are intrusive nodes, so arming,
+// re-arming and cancelling are O(1) no matter how many are pending; expiry
+// costs only the nodes that actually fire plus one cascade every
+// TW_L0_SLOTS ticks.
+
+#define TW_L0_BITS 8
+#define TW_L1_BITS 6
+#define TW_L0_SLOTS (1u << TW_L0_BITS)
+#define TW_L1_SLOTS (1u << TW_L1_BITS)
+
+typedef struct timer_node {
+    struct timer_node *prev;
+    struct timer_node *next;
+    long long expires_ms;
+    uint64_t expires_tick;
+    void *data;
+    int armed;
+} timer_node_t;
+
+typedef struct timer_wheel {
+    long long origin_ms;
+    long long tick_ms;
+    uint64_t current_tick;
+    size_t count;
+    uint64_t l0_bitmap[TW_L0_SLOTS / 64];
+    uint64_t l1_bitmap;
+    timer_node_t l0[TW_L0_SLOTS];
+    timer_node_t l1[TW_L1_SLOTS];
+} timer_wheel_t;
+
+typedef void (*timer_expire_fn)(timer_node_t *node, void *ctx);
+
+void timer_wheel_init(timer_wheel_t *w, long long now_ms, long long tick_ms);
+void timer_node_init(timer_node_t *node, void *data);
+void timer_wheel_schedule(timer_wheel_t *w, timer_node_t *node, long long expires_ms);
+void timer_wheel_cancel(timer_wheel_t *w, timer_node_t *node);
+// Fires every timer due at now_ms. The callback may arm or cancel any timer,
+// including the one it was handed.
+void timer_wheel_advance(timer_wheel_t *w, long long now_ms, timer_expire_fn fn, void *ctx);
+// Milliseconds until the next tick that has work, or -1 when nothing is armed.
+int timer_wheel_next_timeout(const timer_wheel_t *w, long long now_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TIMER_WHEEL_H
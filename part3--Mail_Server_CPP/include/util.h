@@ -6,6 +6,7 @@
 #include <stddef.h>
 
 long long util_now_ms(void);
+uint64_t util_now_ns(void); // monotonic
 int util_set_nonblocking(int fd);
 int util_set_cloexec(int fd);
 uint64_t util_rand64(void);
@@ -33,10 +33,30 @@ size_t buffer_writable(const byte_buffer_t *buf) {
     return buf->capacity - buf->wpos;
 }
 
-ssize_t buffer_fill_from_fd(byte_buffer_t *buf, int fd) {
+// Moves the unread bytes to the front so the consumed prefix can be reused
+// before the buffer has to grow.
+static void buffer_compact(byte_buffer_t *buf) {
+    size_t readable = buffer_readable(buf);
+    if (buf->rpos == 0) return;
+    memmove(buf->data, buf->data + buf->rpos, readable);
+    buf->rpos = 0;
+    buf->wpos = readable;
+}
+
+ssize_t buffer_fill_from_fd(byte_buffer_t *buf, int fd, size_t max_capacity) {
+    if (buffer_writable(buf) == 0) {
+        buffer_compact(buf);
+    }
     if (buffer_writable(buf) == 0) {
-        size_t new_cap = buf->capacity * 2;
-    char *new_data = static_cast<char*>(std::realloc(buf->data, new_cap));
+        if (max_capacity > 0 && buf->capacity >= max_capacity) {
+            errno = ENOBUFS;
+            return -1;
+        }
+        size_t new_cap = buf->capacity ? buf->capacity * 2 : BUFFER_MIN_CAPACITY;
+        if (max_capacity > 0 && new_cap > max_capacity) {
+            new_cap = max_capacity;
+        }
+        char *new_data = static_cast<char*>(std::realloc(buf->data, new_cap));
         if (!new_data) {
             errno = ENOMEM;
             return -1;
@@ -65,9 +85,12 @@ ssize_t buffer_flush_to_fd(byte_buffer_t *buf, int fd) {
 }
 
 int buffer_append(byte_buffer_t *buf, const char *data, size_t len) {
+    if (buffer_writable(buf) < len) {
+        buffer_compact(buf);
+    }
     while (buffer_writable(buf) < len) {
-        size_t new_cap = buf->capacity * 2;
-    char *new_data = static_cast<char*>(std::realloc(buf->data, new_cap));
+        size_t new_cap = buf->capacity ? buf->capacity * 2 : BUFFER_MIN_CAPACITY;
+        char *new_data = static_cast<char*>(std::realloc(buf->data, new_cap));
         if (!new_data) {
             return -1;
         }
@@ -0,0 +1,91 @@
+#include "buffer_pool.h"
+
+#include <cstdlib>
+#include <cstring>
+
+// Index of the smallest class holding len bytes, or -1 if none does.
+static int class_for(size_t len) {
+    size_t size = (size_t)1 << BUFFER_POOL_MIN_SHIFT;
+    for (int i = 0; i < BUFFER_POOL_CLASSES; ++i, size <<= 1) {
+        if (len <= size) return i;
+    }
+    return -1;
+}
+
+// Class whose size is exactly cap, or -1.
+static int class_of(size_t cap) {
+    int idx = class_for(cap);
+    if (idx < 0 || cap != (size_t)1 << (BUFFER_POOL_MIN_SHIFT + idx)) return -1;
+    return idx;
+}
+
+void buffer_pool_init(buffer_pool_t *pool) {
+    memset(pool, 0, sizeof(*pool));
+}
+
+void buffer_pool_destroy(buffer_pool_t *pool) {
+    for (int i = 0; i < BUFFER_POOL_CLASSES; ++i) {
+        buffer_pool_block_t *block = pool->free_list[i];
+        while (block) {
+            buffer_pool_block_t *next = block->next;
+            std::free(block);
+            block = next;
+        }
+    }
+    memset(pool, 0, sizeof(*pool));
+}
+
+int buffer_pool_attach(buffer_pool_t *pool, byte_buffer_t *buf, size_t min_cap) {
+    if (buf->data) return 0;
+    int idx = class_for(min_cap);
+    size_t cap = idx >= 0 ? (size_t)1 << (BUFFER_POOL_MIN_SHIFT + idx) : min_cap;
+    char *data = NULL;
+    if (pool && idx >= 0 && pool->free_list[idx]) {
+        buffer_pool_block_t *block = pool->free_list[idx];
+        pool->free_list[idx] = block->next;
+        pool->cached[idx]--;
+        data = reinterpret_cast<char *>(block);
+    } else {
+        data = static_cast<char *>(std::malloc(cap));
+        if (!data) return -1;
+    }
+    buf->data = data;
+    buf->capacity = cap;
+    buf->rpos = buf->wpos = 0;
+    return 0;
+}
+
+void buffer_pool_release(buffer_pool_t *pool, byte_buffer_t *buf) {
+    if (!buf->data) return;
+    int idx = class_of(buf->capacity);
+    if (pool && idx >= 0 && pool->cached[idx] < BUFFER_POOL_CACHE_MAX) {
+        buffer_pool_block_t *block = reinterpret_cast<buffer_pool_block_t *>(buf->data);
+        block->next = pool->free_list[idx];
+        pool->free_list[idx] = block;
+        pool->cached[idx]++;
+    } else {
+        std::free(buf->data);
+    }
+    buf->data = NULL;
+    buf->capacity = buf->rpos = buf->wpos = 0;
+}
+
+void buffer_pool_trim(buffer_pool_t *pool, byte_buffer_t *buf, size_t min_cap) {
+    size_t readable = buffer_readable(buf);
+    if (readable == 0) {
+        buffer_pool_release(pool, buf);
+        return;
+    }
+    int idx = class_for(readable > min_cap ? readable : min_cap);
+    if (idx < 0 || ((size_t)1 << (BUFFER_POOL_MIN_SHIFT + idx)) >= buf->capacity) {
+        return;
+    }
+    byte_buffer_t smaller = {NULL, 0, 0, 0};
+    if (buffer_pool_attach(pool, &smaller, (size_t)1 << (BUFFER_POOL_MIN_SHIFT + idx)) != 0) {
+        return;
+    }
+    memcpy(smaller.data, buffer_peek(buf), readable);
+    smaller.wpos = readable;
+    buffer_pool_release(pool, buf);
+    *buf = smaller;
+}
@@ -0,0 +1,330 @@
+#include "compress.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <strings.h>
+#include <unordered_map>
+#include <zlib.h>
+
+namespace {
+
+struct CacheKey {
+    uint64_t hash;
+    size_t length;
+    content_coding_t coding;
+
+    bool operator==(const CacheKey &o) const noexcept {
+        return hash == o.hash && length == o.length && coding == o.coding;
+    }
+};
+
+struct CacheKeyHash {
+    size_t operator()(const CacheKey &k) const noexcept {
+        return static_cast<size_t>(k.hash ^ (k.length * 31) ^ k.coding);
+    }
+};
+
+// Word-at-a-time 64-bit hash.
+uint64_t content_hash(const char *data, size_t len) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ len;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, data + i, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, data + i, len - i);
+    h = (h ^ tail) * 0xc4ceb9fe1a85ec53ULL;
+    return h ^ (h >> 29);
+}
+
+// Bytes sampled from the head, middle and tail of a body for its cache key.
+constexpr size_t SAMPLE_BYTES = 256;
+
+// Only picks the bucket: a hit is confirmed against the stored plain bytes,
+// so the key never has to cover the whole body.
+uint64_t sample_hash(const char *data, size_t len) {
+    if (len <= 3 * SAMPLE_BYTES) {
+        return content_hash(data, len);
+    }
+    uint64_t h = content_hash(data, SAMPLE_BYTES);
+    h = h * 31 + content_hash(data + len / 2 - SAMPLE_BYTES / 2, SAMPLE_BYTES);
+    return h * 31 + content_hash(data + len - SAMPLE_BYTES, SAMPLE_BYTES);
+}
+
+// What an entry counts against cache_bytes beyond its strings, so bodies
+// that do not shrink (stored without a compressed form) still take room.
+constexpr size_t ENTRY_COST = 128;
+
+int window_bits(content_coding_t coding) {
+    return coding == CODING_GZIP ? 15 + 16 : 15; // gzip wrapper, else zlib
+}
+
+const char *coding_name(content_coding_t coding) {
+    return coding == CODING_GZIP ? "gzip" : "deflate";
+}
+
+// One-shot compression into a malloc'd buffer. Fails when the body does not
+// shrink.
+int deflate_all(const char *data, size_t len, content_coding_t coding, int level,
+                char **out, size_t *out_len) {
+    if (len > UINT_MAX) {
+        return -1;
+    }
+    z_stream zs{};
+    if (deflateInit2(&zs, level, Z_DEFLATED, window_bits(coding), 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return -1;
+    }
+    const size_t bound = deflateBound(&zs, static_cast<uLong>(len));
+    char *buf = static_cast<char *>(std::malloc(bound));
+    if (!buf) {
+        deflateEnd(&zs);
+        return -1;
+    }
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    zs.avail_in = static_cast<uInt>(len);
+    zs.next_out = reinterpret_cast<Bytef *>(buf);
+    zs.avail_out = static_cast<uInt>(bound);
+    const int rc = deflate(&zs, Z_FINISH);
+    const size_t produced = bound - zs.avail_out;
+    deflateEnd(&zs);
+    if (rc != Z_STREAM_END || produced >= len) {
+        std::free(buf);
+        return -1;
+    }
+    *out = buf;
+    *out_len = produced;
+    return 0;
+}
+
+// Parses a q-value ("1", "0.5", "0.125") into thousandths.
+int parse_qvalue(const char *p) {
+    int q = (*p == '1') ? 1000 : 0;
+    if (*p != '0' && *p != '1') {
+        return 0;
+    }
+    ++p;
+    if (*p == '.') {
+        int scale = 100;
+        for (++p; *p >= '0' && *p <= '9' && scale > 0; ++p, scale /= 10) {
+            q += (*p - '0') * scale;
+        }
+    }
+    return q > 1000 ? 1000 : q;
+}
+
+} // namespace
+
+struct CacheEntry {
+    std::string plain;  // the body as served, compared on every hit
+    std::string packed; // its compressed form, empty when it does not shrink
+
+    size_t cost() const noexcept { return plain.size() + packed.size() + ENTRY_COST; }
+};
+
+struct compressor {
+    compress_config_t cfg;
+    std::mutex lock;
+    // Cacheable bodies and their compressed forms. Evicted oldest first once
+    // over cache_bytes.
+    std::unordered_map<CacheKey, CacheEntry, CacheKeyHash> cache;
+    std::deque<CacheKey> order;
+    size_t cached_bytes{0};
+};
+
+struct compress_stream {
+    z_stream zs;
+};
+
+compressor_t *compressor_create(const compress_config_t *cfg) {
+    auto *c = new (std::nothrow) compressor{};
+    if (!c) return NULL;
+    c->cfg = *cfg;
+    if (c->cfg.level > 9) c->cfg.level = 9;
+    if (c->cfg.static_level < 1 || c->cfg.static_level > 9) c->cfg.static_level = c->cfg.level;
+    return c;
+}
+
+void compressor_destroy(compressor_t *c) {
+    delete c;
+}
+
+content_coding_t compress_negotiate(const http_request_t *req) {
+    const char *value = http_request_header(req, HTTP_HDR_ACCEPT_ENCODING);
+    if (!value) {
+        return CODING_IDENTITY;
+    }
+    int gzip_q = -1, deflate_q = -1, any_q = -1;
+    const char *p = value;
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') ++p;
+        const char *name = p;
+        while (*p && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') ++p;
+        const size_t name_len = static_cast<size_t>(p - name);
+        int q = 1000;
+        while (*p && *p != ',') {
+            if (*p == ';') {
+                ++p;
+                while (*p == ' ' || *p == '\t') ++p;
+                if ((p[0] == 'q' || p[0] == 'Q') && p[1] == '=') {
+                    q = parse_qvalue(p + 2);
+                }
+            } else {
+                ++p;
+            }
+        }
+        if (name_len == 4 && strncasecmp(name, "gzip", 4) == 0) gzip_q = q;
+        else if (name_len == 7 && strncasecmp(name, "deflate", 7) == 0) deflate_q = q;
+        else if (name_len == 1 && *name == '*') any_q = q;
+    }
+    if (gzip_q < 0) gzip_q = any_q;
+    if (deflate_q < 0) deflate_q = any_q;
+    if (gzip_q > 0 && gzip_q >= deflate_q) return CODING_GZIP;
+    if (deflate_q > 0) return CODING_DEFLATE;
+    return CODING_IDENTITY;
+}
+
+// Looks a cacheable body up, compressing and storing it on a miss. The key
+// only samples the body, so a hit is served only when the stored plain bytes
+// match it exactly; a different body under the same key replaces the entry.
+// The deflate runs outside the lock; two workers missing at once both
+// compress and the last insert wins.
+static int cached_compress(compressor_t *c, const http_response_t *res, content_coding_t coding,
+                           char **out, size_t *out_len) {
+    const CacheKey key{sample_hash(res->body, res->body_length), res->body_length, coding};
+    {
+        std::lock_guard<std::mutex> guard(c->lock);
+        auto it = c->cache.find(key);
+        if (it != c->cache.end() &&
+            memcmp(it->second.plain.data(), res->body, res->body_length) == 0) {
+            const std::string &packed = it->second.packed;
+            if (packed.empty()) {
+                return -1;
+            }
+            *out = static_cast<char *>(std::malloc(packed.size()));
+            if (!*out) return -1;
+            memcpy(*out, packed.data(), packed.size());
+            *out_len = packed.size();
+            return 0;
+        }
+    }
+
+    const int rc = deflate_all(res->body, res->body_length, coding, c->cfg.static_level, out, out_len);
+    CacheEntry entry;
+    entry.plain.assign(res->body, res->body_length);
+    if (rc == 0) {
+        entry.packed.assign(*out, *out_len);
+    }
+    if (entry.cost() <= c->cfg.cache_bytes) {
+        std::lock_guard<std::mutex> guard(c->lock);
+        auto [it, inserted] = c->cache.try_emplace(key);
+        if (inserted) {
+            c->order.push_back(key);
+        } else {
+            c->cached_bytes -= it->second.cost();
+        }
+        c->cached_bytes += entry.cost();
+        it->second = std::move(entry);
+        while (c->cached_bytes > c->cfg.cache_bytes && !c->order.empty()) {
+            auto victim = c->cache.find(c->order.front());
+            c->cached_bytes -= victim->second.cost();
+            c->cache.erase(victim);
+            c->order.pop_front();
+        }
+    }
+    return rc;
+}
+
+void compress_response(compressor_t *c, http_response_t *res, content_coding_t coding) {
+    if (!c || c->cfg.level <= 0 || res->chunked || !res->body ||
+        res->body_length < c->cfg.min_size || !http_response_compressible(res)) {
+        return;
+    }
+    http_response_set_header(res, "Vary", "Accept-Encoding");
+    if (coding == CODING_IDENTITY) {
+        return;
+    }
+    char *out = NULL;
+    size_t out_len = 0;
+    const int rc = res->cacheable
+        ? cached_compress(c, res, coding, &out, &out_len)
+        : deflate_all(res->body, res->body_length, coding, c->cfg.level, &out, &out_len);
+    if (rc != 0) {
+        return;
+    }
+    std::free(res->body);
+    res->body = out;
+    res->body_length = out_len;
+    res->body_capacity = 0;
+    http_response_set_header(res, "Content-Encoding", coding_name(coding));
+}
+
+compress_stream_t *compress_stream_begin(compressor_t *c, http_response_t *res, content_coding_t coding) {
+    if (!c || c->cfg.level <= 0 || !http_response_compressible(res)) {
+        return NULL;
+    }
+    http_response_set_header(res, "Vary", "Accept-Encoding");
+    if (coding == CODING_IDENTITY) {
+        return NULL;
+    }
+    auto *s = new (std::nothrow) compress_stream{};
+    if (!s) return NULL;
+    if (deflateInit2(&s->zs, c->cfg.level, Z_DEFLATED, window_bits(coding), 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        delete s;
+        return NULL;
+    }
+    http_response_set_header(res, "Content-Encoding", coding_name(coding));
+    return s;
+}
+
+int compress_stream_chunk(compress_stream_t *s, http_response_t *res, int last) {
+    const size_t in_len = res->body ? res->body_length : 0;
+    if (in_len > UINT_MAX) {
+        return -1;
+    }
+    size_t cap = deflateBound(&s->zs, static_cast<uLong>(in_len)) + 64;
+    char *out = static_cast<char *>(std::malloc(cap));
+    if (!out) return -1;
+    s->zs.next_in = reinterpret_cast<Bytef *>(res->body);
+    s->zs.avail_in = static_cast<uInt>(in_len);
+    size_t produced = 0;
+    for (;;) {
+        s->zs.next_out = reinterpret_cast<Bytef *>(out + produced);
+        s->zs.avail_out = static_cast<uInt>(cap - produced);
+        const int rc = deflate(&s->zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+        produced = cap - s->zs.avail_out;
+        if (rc == Z_STREAM_ERROR) {
+            std::free(out);
+            return -1;
+        }
+        // Done once the flush left room to spare (or the stream ended).
+        if (last ? rc == Z_STREAM_END : s->zs.avail_out > 0) {
+            break;
+        }
+        char *grown = static_cast<char *>(std::realloc(out, cap * 2));
+        if (!grown) {
+            std::free(out);
+            return -1;
+        }
+        out = grown;
+        cap *= 2;
+    }
+    std::free(res->body);
+    res->body = out;
+    res->body_length = produced;
+    res->body_capacity = 0;
+    return 0;
+}
+
+void compress_stream_end(compress_stream_t *s) {
+    if (!s) return;
+    deflateEnd(&s->zs);
+    delete s;
+}
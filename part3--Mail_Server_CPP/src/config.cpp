@@ -90,6 +90,83 @@ bool load_config(const std::filesystem::path &path, ServerConfig &cfg) {
             cfg.max_connections = static_cast<std::size_t>(parse_number(token_view(json, tokens[++i]), cfg.max_connections));
         } else if (key == "thread_pool_size") {
             cfg.thread_pool_size = static_cast<std::size_t>(parse_number(token_view(json, tokens[++i]), cfg.thread_pool_size));
+        } else if (key == "response_ring_size") {
+            cfg.response_ring_size = static_cast<std::size_t>(parse_number(token_view(json, tokens[++i]), cfg.response_ring_size));
+        } else if (key == "pool_queue_capacity") {
+            cfg.pool_queue_capacity = static_cast<std::size_t>(parse_number(token_view(json, tokens[++i]), cfg.pool_queue_capacity));
+        } else if (key == "pool_reserved_workers") {
+            cfg.pool_reserved_workers = static_cast<std::size_t>(parse_number(token_view(json, tokens[++i]), cfg.pool_reserved_workers));
+        } else if (key == "pool_weight_interactive") {
+            cfg.pool_weight_interactive = static_cast<unsigned>(parse_number(token_view(json, tokens[++i]), cfg.pool_weight_interactive));
+        } else if (key == "pool_weight_bulk") {
+            cfg.pool_weight_bulk = static_cast<unsigned>(parse_number(token_view(json, tokens[++i]), cfg.pool_weight_bulk));
+        } else if (key == "pool_weight_background") {
+            cfg.pool_weight_background = static_cast<unsigned>(parse_number(token_view(json, tokens[++i]), cfg.pool_weight_background));
+        } else if (key == "tenant_key") {
+            std::string value = to_string(token_view(json, tokens[++i]));
+            cfg.tenant_key = (value == "ip") ? TenantKey::Ip : TenantKey::User;
+        } else if (key == "tenant_max_inflight") {
+            cfg.tenant_max_inflight = parse_number(token_view(json, tokens[++i]), cfg.tenant_max_inflight);
+        } else if (key == "tenant_queue_limit") {
+            cfg.tenant_queue_limit = static_cast<std::size_t>(parse_number(token_view(json, tokens[++i]), cfg.tenant_queue_limit));
+        } else if (key == "tenant_quantum_us") {
+            cfg.tenant_quantum_us = parse_number(token_view(json, tokens[++i]), cfg.tenant_quantum_us);
+        } else if (key == "overflow_limit") {
+            cfg.overflow_limit = static_cast<std::size_t>(parse_number(token_view(json, tokens[++i]), cfg.overflow_limit));
+        } else if (key == "latency_budget_ms") {
+            cfg.latency_budget_ms = parse_number(token_view(json, tokens[++i]), cfg.latency_budget_ms);
+        } else if (key == "retry_after_s") {
+            cfg.retry_after_s = parse_number(token_view(json, tokens[++i]), cfg.retry_after_s);
+        } else if (key == "reactor_count") {
+            cfg.reactor_count = static_cast<std::size_t>(parse_number(token_view(json, tokens[++i]), cfg.reactor_count));
+        } else if (key == "pool_queue") {
+            std::string value = to_string(token_view(json, tokens[++i]));
+            cfg.pool_queue = (value == "mpmc") ? PoolQueue::Mpmc : PoolQueue::Mutex;
+        } else if (key == "io_engine") {
+            std::string value = to_string(token_view(json, tokens[++i]));
+            cfg.io_engine = (value == "io_uring") ? IoEngine::IoUring : IoEngine::Epoll;
+        } else if (key == "idle_timeout_ms") {
+            cfg.idle_timeout_ms = parse_number(token_view(json, tokens[++i]), cfg.idle_timeout_ms);
+        } else if (key == "header_timeout_ms") {
+            cfg.header_timeout_ms = parse_number(token_view(json, tokens[++i]), cfg.header_timeout_ms);
+        } else if (key == "write_timeout_ms") {
+            cfg.write_timeout_ms = parse_number(token_view(json, tokens[++i]), cfg.write_timeout_ms);
+        } else if (key == "timer_tick_ms") {
+            cfg.timer_tick_ms = parse_number(token_view(json, tokens[++i]), cfg.timer_tick_ms);
+        } else if (key == "read_budget_bytes") {
+            cfg.read_budget_bytes = static_cast<std::size_t>(parse_number(token_view(json, tokens[++i]), cfg.read_budget_bytes));
+        } else if (key == "read_budget_reads") {
+            cfg.read_budget_reads = parse_number(token_view(json, tokens[++i]), cfg.read_budget_reads);
+        } else if (key == "pipeline_depth") {
+            cfg.pipeline_depth = parse_number(token_view(json, tokens[++i]), cfg.pipeline_depth);
+        } else if (key == "max_output_bytes") {
+            cfg.max_output_bytes = static_cast<std::size_t>(parse_number(token_view(json, tokens[++i]), cfg.max_output_bytes));
+        } else if (key == "direct_writes") {
+            cfg.direct_writes = token_view(json, tokens[++i]) == "true";
+        } else if (key == "max_header_bytes") {
+            cfg.max_header_bytes = static_cast<std::size_t>(parse_number(token_view(json, tokens[++i]), cfg.max_header_bytes));
+        } else if (key == "max_body_bytes") {
+            cfg.max_body_bytes = static_cast<std::size_t>(parse_number(token_view(json, tokens[++i]), cfg.max_body_bytes));
+        } else if (key == "body_spool_threshold") {
+            cfg.body_spool_threshold = static_cast<std::size_t>(parse_number(token_view(json, tokens[++i]), cfg.body_spool_threshold));
+        } else if (key == "spool_dir") {
+            cfg.spool_dir = std::filesystem::path(to_string(token_view(json, tokens[++i])));
+        } else if (key == "stream_chunk_bytes") {
+            cfg.stream_chunk_bytes = static_cast<std::size_t>(parse_number(token_view(json, tokens[++i]), cfg.stream_chunk_bytes));
+        } else if (key == "stream_window_bytes") {
+            cfg.stream_window_bytes = static_cast<std::size_t>(parse_number(token_view(json, tokens[++i]), cfg.stream_window_bytes));
+        } else if (key == "stream_wait_ms") {
+            cfg.stream_wait_ms = parse_number(token_view(json, tokens[++i]), cfg.stream_wait_ms);
+        } else if (key == "stream_max_waiting") {
+            cfg.stream_max_waiting = parse_number(token_view(json, tokens[++i]), cfg.stream_max_waiting);
+        } else if (key == "compression_level") {
+            cfg.compression_level = static_cast<int>(parse_number(token_view(json, tokens[++i]), cfg.compression_level));
+        } else if (key == "compression_static_level") {
+            cfg.compression_static_level = static_cast<int>(parse_number(token_view(json, tokens[++i]), cfg.compression_static_level));
+        } else if (key == "compression_min_bytes") {
+            cfg.compression_min_bytes = static_cast<std::size_t>(parse_number(token_view(json, tokens[++i]), cfg.compression_min_bytes));
+        } else if (key == "compression_cache_bytes") {
+            cfg.compression_cache_bytes = static_cast<std::size_t>(parse_number(token_view(json, tokens[++i]), cfg.compression_cache_bytes));
         } else if (key == "static_dir") {
             cfg.static_dir = std::filesystem::path(to_string(token_view(json, tokens[++i])));
         } else if (key == "template_dir") {
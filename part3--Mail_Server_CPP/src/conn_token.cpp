@@ -0,0 +1,130 @@
+#include "conn_token.h"
+#include "util.h"
+
+#include <climits>
+#include <cstdlib>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+static void wake_streamer(conn_token_t *t) {
+    __atomic_add_fetch(&t->stream_wake, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &t->stream_wake, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+conn_token_t *conn_token_new(void) {
+    conn_token_t *t = static_cast<conn_token_t*>(std::malloc(sizeof(conn_token_t)));
+    if (!t) return NULL;
+    t->refs = 1;
+    t->cancelled = 0;
+    t->write_gate = CONN_GATE_REACTOR;
+    t->head_seq = 0;
+    t->stream_wake = 0;
+    t->stream_backlog = 0;
+    return t;
+}
+
+conn_token_t *conn_token_ref(conn_token_t *t) {
+    if (t) __atomic_add_fetch(&t->refs, 1, __ATOMIC_RELAXED);
+    return t;
+}
+
+void conn_token_unref(conn_token_t *t) {
+    if (t && __atomic_sub_fetch(&t->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        std::free(t);
+    }
+}
+
+void conn_token_cancel(conn_token_t *t) {
+    if (!t) return;
+    __atomic_store_n(&t->cancelled, 1, __ATOMIC_RELEASE);
+    wake_streamer(t);
+}
+
+int conn_token_cancelled(const conn_token_t *t) {
+    return t && __atomic_load_n(&t->cancelled, __ATOMIC_ACQUIRE) != 0;
+}
+
+static uint64_t gate_word(uint32_t seq, uint64_t state) {
+    return ((uint64_t)seq << 2) | state;
+}
+
+void conn_token_open_writes(conn_token_t *t, uint32_t seq) {
+    __atomic_store_n(&t->write_gate, gate_word(seq, CONN_GATE_OPEN), __ATOMIC_RELEASE);
+}
+
+int conn_token_reclaim_writes(conn_token_t *t) {
+    uint64_t cur = __atomic_load_n(&t->write_gate, __ATOMIC_ACQUIRE);
+    while ((cur & 3) == CONN_GATE_OPEN) {
+        if (__atomic_compare_exchange_n(&t->write_gate, &cur, CONN_GATE_REACTOR, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return 1;
+        }
+    }
+    return (cur & 3) == CONN_GATE_REACTOR;
+}
+
+int conn_token_close_writes(conn_token_t *t) {
+    uint64_t prev = __atomic_exchange_n(&t->write_gate, CONN_GATE_CLOSED, __ATOMIC_ACQ_REL);
+    return (prev & 3) != CONN_GATE_WORKER;
+}
+
+int conn_token_claim_writes(conn_token_t *t, uint32_t seq) {
+    uint64_t expected = gate_word(seq, CONN_GATE_OPEN);
+    return __atomic_compare_exchange_n(&t->write_gate, &expected, gate_word(seq, CONN_GATE_WORKER), 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+int conn_token_release_writes(conn_token_t *t) {
+    uint64_t cur = __atomic_load_n(&t->write_gate, __ATOMIC_ACQUIRE);
+    while ((cur & 3) == CONN_GATE_WORKER) {
+        if (__atomic_compare_exchange_n(&t->write_gate, &cur, CONN_GATE_REACTOR, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void conn_token_set_head(conn_token_t *t, uint32_t seq) {
+    if (__atomic_load_n(&t->head_seq, __ATOMIC_RELAXED) != seq) {
+        __atomic_store_n(&t->head_seq, seq, __ATOMIC_RELEASE);
+        wake_streamer(t);
+    }
+}
+
+void conn_token_stream_written(conn_token_t *t, uint64_t bytes) {
+    __atomic_sub_fetch(&t->stream_backlog, bytes, __ATOMIC_ACQ_REL);
+    wake_streamer(t);
+}
+
+void conn_token_stream_posted(conn_token_t *t, uint64_t bytes) {
+    __atomic_add_fetch(&t->stream_backlog, bytes, __ATOMIC_ACQ_REL);
+}
+
+int conn_token_stream_wait(conn_token_t *t, uint32_t seq, uint64_t window, uint32_t timeout_ms) {
+    const uint64_t deadline = util_now_ns() + (uint64_t)timeout_ms * 1000000ull;
+    for (;;) {
+        // Read the futex word first so a wake between the checks and the
+        // wait makes the wait return at once.
+        uint32_t wake = __atomic_load_n(&t->stream_wake, __ATOMIC_ACQUIRE);
+        if (conn_token_cancelled(t)) {
+            return -1;
+        }
+        // A response still queued behind earlier ones never waits; the
+        // responses ahead of it may come from tasks the pool has not run.
+        if (__atomic_load_n(&t->head_seq, __ATOMIC_ACQUIRE) != seq ||
+            __atomic_load_n(&t->stream_backlog, __ATOMIC_ACQUIRE) <= window) {
+            return 0;
+        }
+        const uint64_t now = util_now_ns();
+        if (now >= deadline) {
+            return 1;
+        }
+        struct timespec rel;
+        rel.tv_sec = (time_t)((deadline - now) / 1000000000ull);
+        rel.tv_nsec = (long)((deadline - now) % 1000000000ull);
+        syscall(SYS_futex, &t->stream_wake, FUTEX_WAIT_PRIVATE, wake, &rel, NULL, 0);
+    }
+}
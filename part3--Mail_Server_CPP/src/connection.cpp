@@ -7,90 +7,245 @@
 #include <errno.h>
 #include <stdio.h>
 
-int connection_init(connection_t *c, int fd) {
+int connection_init(connection_t *c, int fd, uint64_t id, buffer_pool_t *pool,
+                    const http_body_limits_t *limits) {
     memset(c, 0, sizeof(*c));
     c->fd = fd;
+    c->id = id;
+    c->token = conn_token_new();
     c->state = CONN_STATE_READING;
-    buffer_init(&c->read_buf, READ_BUFFER_SIZE);
-    buffer_init(&c->write_buf, WRITE_BUFFER_SIZE);
-    http_parser_init(&c->parser);
-    http_response_init(&c->response);
+    c->pool = pool;
+    out_queue_init(&c->out, pool, WRITE_BUFFER_SIZE);
+    http_parser_init(&c->parser, limits);
+    timer_node_init(&c->timer, c);
     c->keep_alive = 1;
     c->last_activity_ms = util_now_ms();
     return 0;
 }
 
 void connection_free(connection_t *c) {
-    buffer_free(&c->read_buf);
-    buffer_free(&c->write_buf);
-    http_request_free(&c->parser.request);
-    http_response_free(&c->response);
-    close(c->fd);
+    buffer_pool_release(c->pool, &c->read_buf);
+    out_queue_free(&c->out);
+    http_parser_free(&c->parser);
+    conn_token_cancel(c->token);
+    // A worker still writing directly closes the fd once it is done.
+    int owns_fd = !c->token || conn_token_close_writes(c->token);
+    conn_token_unref(c->token);
+    c->token = NULL;
+    if (owns_fd) {
+        close(c->fd);
+    }
     c->fd = -1;
 }
 
-int connection_handle_read(connection_t *c) {
-    ssize_t n = buffer_fill_from_fd(&c->read_buf, c->fd);
-    if (n == 0) {
-        return -1; // peer closed
+int connection_handle_read(connection_t *c, size_t max_bytes, unsigned max_reads) {
+    if (buffer_pool_attach(c->pool, &c->read_buf, READ_BUFFER_SIZE) != 0) {
+        return -1;
     }
-    if (n < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            return 0;
+    size_t total = 0;
+    int rc = 1;
+    for (unsigned i = 0; i < max_reads && total < max_bytes; ++i) {
+        size_t room = buffer_writable(&c->read_buf);
+        ssize_t n = buffer_fill_from_fd(&c->read_buf, c->fd, connection_read_limit(c));
+        if (n == 0) {
+            return -1; // peer closed
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                rc = 0;
+                break;
+            }
+            if (errno == ENOBUFS) {
+                break; // full; the parser has to drain it first
+            }
+            return -1;
+        }
+        total += (size_t)n;
+        // A short read means the socket queue is empty; any later data raises
+        // a new edge, so the EAGAIN round trip can be skipped.
+        if (room > 0 && (size_t)n < room) {
+            rc = 0;
+            break;
         }
-        return -1;
     }
-    c->last_activity_ms = util_now_ms();
-    return 0;
+    if (total > 0) {
+        c->last_activity_ms = util_now_ms();
+    }
+    return rc;
 }
 
 int connection_handle_write(connection_t *c) {
-    ssize_t n = buffer_flush_to_fd(&c->write_buf, c->fd);
+    ssize_t n = out_queue_writev(&c->out, c->fd);
     if (n < 0) {
         if (errno == EAGAIN || errno == EWOULDBLOCK) {
             return 0;
         }
         return -1;
     }
-    if (buffer_readable(&c->write_buf) == 0) {
-        if (c->keep_alive) {
-            http_parser_reset(&c->parser);
-            http_response_reset(&c->response);
-            c->state = CONN_STATE_READING;
-        } else {
+    if (n > 0) {
+        c->last_activity_ms = util_now_ms();
+    }
+    if (out_queue_pending(&c->out) == 0) {
+        // The parser may already hold the next pipelined request; leave it be.
+        if (!c->keep_alive) {
             c->state = CONN_STATE_CLOSING;
+        } else if (connection_inflight(c) > 0) {
+            c->state = CONN_STATE_PROCESSING;
+        } else {
+            c->state = CONN_STATE_READING;
         }
     }
     return 0;
 }
 
-void connection_prepare_response(connection_t *c, const http_response_t *res) {
-    buffer_reset(&c->write_buf);
+// Writes v in decimal at dst (room for 20 digits), returning the length.
+static size_t format_decimal(char *dst, size_t v) {
+    char tmp[20];
+    size_t n = 0;
+    do {
+        tmp[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] = tmp[n - 1 - i];
+    }
+    return n;
+}
+
+static void append_literal(byte_buffer_t *out, const char *s) {
+    buffer_append(out, s, strlen(s));
+}
+
+void connection_serialize_head(byte_buffer_t *out, const http_response_t *res) {
+    // Status line and the framing headers are assembled with plain copies;
+    // everything static comes from the response's precomputed header block.
+    char line[128];
+    size_t len = 0;
+    memcpy(line, "HTTP/1.1 ", 9);
+    len = 9 + format_decimal(line + 9, res->status_code > 0 ? (size_t)res->status_code : 0);
+    line[len++] = ' ';
+    size_t text_len = strnlen(res->status_text, sizeof(res->status_text));
+    memcpy(line + len, res->status_text, text_len);
+    len += text_len;
+    line[len++] = '\r';
+    line[len++] = '\n';
+    buffer_append(out, line, len);
 
-    char header[1024];
-    int len = snprintf(header, sizeof(header),
-        "%s %d %s\r\n",
-        "HTTP/1.1", res->status_code, res->status_text);
-    buffer_append(&c->write_buf, header, len);
+    if (res->header_block) {
+        buffer_append(out, res->header_block->data, res->header_block->len);
+    }
+    const char *date = http_date_line();
+    if (date[0]) {
+        buffer_append(out, date, HTTP_DATE_LINE_LEN);
+    }
+    if (res->extra_headers_len > 0) {
+        buffer_append(out, res->extra_headers, res->extra_headers_len);
+    }
 
-    for (size_t i = 0; i < res->header_count; ++i) {
-        len = snprintf(header, sizeof(header), "%s: %s\r\n",
-                       res->headers[i].name, res->headers[i].value);
-        buffer_append(&c->write_buf, header, len);
+    if (res->chunked) {
+        append_literal(out, "Transfer-Encoding: chunked\r\n");
+    } else {
+        memcpy(line, "Content-Length: ", 16);
+        len = 16 + format_decimal(line + 16, res->body_length);
+        line[len++] = '\r';
+        line[len++] = '\n';
+        buffer_append(out, line, len);
     }
 
-    len = snprintf(header, sizeof(header), "Content-Length: %zu\r\n", res->body_length);
-    buffer_append(&c->write_buf, header, len);
+    if (res->keep_alive) {
+        append_literal(out, "Connection: keep-alive\r\n\r\n");
+    } else {
+        append_literal(out, "Connection: close\r\n\r\n");
+    }
+}
 
-    len = snprintf(header, sizeof(header), "Connection: %s\r\n\r\n",
-                   res->keep_alive ? "keep-alive" : "close");
-    buffer_append(&c->write_buf, header, len);
+// Queues the body, moving it unless it is small enough to copy.
+static void append_body(out_queue_t *q, http_response_t *res) {
+    if (res->body_length <= OUT_QUEUE_COPY_MAX) {
+        out_queue_append_copy(q, res->body, res->body_length);
+    } else {
+        out_queue_append_owned(q, res->body, res->body, res->body_length);
+        res->body = NULL;
+    }
+}
+
+// The body as one chunk: its size line, the bytes and the closing CRLF.
+static void append_chunk(out_queue_t *q, http_response_t *res) {
+    static const char hex[] = "0123456789abcdef";
+    char line[20];
+    size_t n = 0;
+    for (int shift = (int)(sizeof(size_t) * 8) - 4; shift >= 0; shift -= 4) {
+        unsigned digit = (unsigned)(res->body_length >> shift) & 0xf;
+        if (digit || n) line[n++] = hex[digit];
+    }
+    line[n++] = '\r';
+    line[n++] = '\n';
+    out_queue_append_copy(q, line, n);
+    append_body(q, res);
+    out_queue_append_ref(q, "\r\n", 2);
+}
+
+void connection_prepare_response(connection_t *c, http_response_t *res) {
+    // The head goes straight into the staging buffer as one segment.
+    out_queue_t *q = &c->out;
+    byte_buffer_t *staging = out_queue_staging(q);
+    if (staging) {
+        size_t head_start = staging->wpos;
+        connection_serialize_head(staging, res);
+        out_queue_commit_staged(q, head_start);
+    }
 
     if (res->body && res->body_length > 0) {
-        buffer_append(&c->write_buf, res->body, res->body_length);
+        if (res->chunked) {
+            append_chunk(q, res);
+        } else {
+            append_body(q, res);
+        }
     }
 
     c->state = CONN_STATE_WRITING;
     c->keep_alive = res->keep_alive;
     c->last_activity_ms = util_now_ms();
 }
+
+void connection_append_chunk(connection_t *c, http_response_t *res, int last) {
+    out_queue_t *q = &c->out;
+    if (res->body && res->body_length > 0) {
+        append_chunk(q, res);
+    }
+    if (last) {
+        out_queue_append_ref(q, "0\r\n\r\n", 5);
+    }
+    c->state = CONN_STATE_WRITING;
+    c->keep_alive = res->keep_alive;
+    c->last_activity_ms = util_now_ms();
+}
+
+void connection_append_raw(connection_t *c, char *owned, const char *data, size_t len) {
+    out_queue_append_owned(&c->out, owned, data, len);
+    c->state = CONN_STATE_WRITING;
+    c->last_activity_ms = util_now_ms();
+}
+
+uint32_t connection_inflight(const connection_t *c) {
+    return c->next_seq - c->write_seq;
+}
+
+size_t connection_read_limit(const connection_t *c) {
+    const http_body_limits_t *limits = c->parser.limits;
+    if (!limits || limits->max_header == 0) {
+        return 0;
+    }
+    return limits->max_header + READ_BODY_CHUNK;
+}
+
+void connection_release_buffers(connection_t *c) {
+    // Mid-body the buffer is about to refill at its current size; leave it.
+    if (c->parser.headers_complete) {
+        return;
+    }
+    buffer_pool_trim(c->pool, &c->read_buf, READ_BUFFER_SIZE);
+}
@@ -0,0 +1,196 @@
+#include "fair_queue.h"
+#include "jobs.h"
+
+#include <algorithm>
+
+namespace mail {
+
+namespace {
+
+// A job is never charged more than this many quanta, so one tenant with
+// very slow jobs costs a bounded number of rounds per job.
+constexpr std::int64_t kMaxCostQuanta = 64;
+
+std::size_t shard_of(std::uint64_t key, std::size_t shards) {
+    return static_cast<std::size_t>((key * 0x9e3779b97f4a7c15ULL) >> 32) % shards;
+}
+
+} // namespace
+
+TenantTable::~TenantTable() {
+    for (Shard &shard : shards_) {
+        for (auto &entry : shard.tenants) {
+            delete entry.second;
+        }
+    }
+}
+
+Tenant *TenantTable::acquire(std::uint64_t key) {
+    Shard &shard = shards_[shard_of(key, kShards)];
+    std::lock_guard<std::mutex> guard(shard.lock);
+    Tenant *&slot = shard.tenants[key];
+    if (!slot) {
+        slot = new Tenant{};
+        slot->key = key;
+    }
+    slot->refs++;
+    return slot;
+}
+
+void TenantTable::release(Tenant *tenant) {
+    Shard &shard = shards_[shard_of(tenant->key, kShards)];
+    std::lock_guard<std::mutex> guard(shard.lock);
+    if (--tenant->refs == 0) {
+        shard.tenants.erase(tenant->key);
+        delete tenant;
+    }
+}
+
+bool tenant_enter(Tenant *tenant, std::uint32_t max_inflight) {
+    std::uint32_t n = __atomic_load_n(&tenant->inflight, __ATOMIC_RELAXED);
+    do {
+        if (n >= max_inflight) {
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&tenant->inflight, &n, n + 1, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    return true;
+}
+
+void tenant_leave(Tenant *tenant) {
+    __atomic_sub_fetch(&tenant->inflight, 1, __ATOMIC_RELEASE);
+}
+
+void tenant_rejoin(Tenant *tenant) {
+    __atomic_add_fetch(&tenant->inflight, 1, __ATOMIC_ACQ_REL);
+}
+
+void tenant_job_done(Tenant *tenant, std::uint64_t ns) {
+    std::uint64_t avg = __atomic_load_n(&tenant->avg_job_ns, __ATOMIC_RELAXED);
+    avg = avg == 0 ? ns : avg - avg / 8 + ns / 8;
+    __atomic_store_n(&tenant->avg_job_ns, avg, __ATOMIC_RELAXED);
+    tenant_leave(tenant);
+}
+
+FairQueue::~FairQueue() {
+    while (WorkerTask *task = pop()) {
+        delete task;
+    }
+}
+
+void FairQueue::push(WorkerTask *task) {
+    Flow &flow = flows_[task->tenant];
+    task->next = nullptr;
+    if (flow.tail) {
+        flow.tail->next = task;
+    } else {
+        // A new flow joins at the back with no credit.
+        flow.tenant = task->tenant;
+        flow.head = task;
+        flow.next = nullptr;
+        if (active_tail_) active_tail_->next = &flow;
+        else active_head_ = &flow;
+        active_tail_ = &flow;
+    }
+    flow.tail = task;
+    size_++;
+    __atomic_add_fetch(&task->tenant->waiting, 1, __ATOMIC_RELAXED);
+}
+
+WorkerTask *FairQueue::pop() {
+    Flow *flow = active_head_;
+    if (!flow) return nullptr;
+    WorkerTask *task = flow->head;
+    flow->head = task->next;
+    task->next = nullptr;
+    size_--;
+    __atomic_sub_fetch(&task->tenant->waiting, 1, __ATOMIC_RELAXED);
+    if (!flow->head) {
+        unlink_front();
+    }
+    return task;
+}
+
+// Drops the (empty) flow at the front; its credit goes with it.
+void FairQueue::unlink_front() {
+    Flow *flow = active_head_;
+    active_head_ = flow->next;
+    if (!active_head_) active_tail_ = nullptr;
+    flows_.erase(flow->tenant);
+}
+
+void FairQueue::rotate() {
+    if (active_head_ == active_tail_) return;
+    Flow *flow = active_head_;
+    active_head_ = flow->next;
+    flow->next = nullptr;
+    active_tail_->next = flow;
+    active_tail_ = flow;
+}
+
+bool FairQueue::drain(std::uint64_t quantum_ns, std::uint32_t max_inflight, SubmitFn submit, void *ctx) {
+    const std::int64_t quantum = static_cast<std::int64_t>(std::max<std::uint64_t>(quantum_ns, 1));
+    // Flows in a row that could not send because their tenant is at its
+    // limit; once every flow is, only a finishing job can change that.
+    std::size_t blocked = 0;
+    while (active_head_ && blocked < flows_.size()) {
+        Flow *flow = active_head_;
+        if (!flow->in_turn) {
+            if (__atomic_load_n(&flow->tenant->inflight, __ATOMIC_RELAXED) >= max_inflight) {
+                blocked++;
+                rotate();
+                continue;
+            }
+            flow->deficit_ns += quantum;
+            flow->in_turn = true;
+        }
+        bool sent = false;
+        bool at_limit = false;
+        while (flow->head) {
+            // Read the tenant through the head task: a sent task may finish
+            // and drop the last reference to it at any time.
+            Tenant *tenant = flow->head->tenant;
+            const std::int64_t avg = static_cast<std::int64_t>(__atomic_load_n(&tenant->avg_job_ns, __ATOMIC_RELAXED));
+            const std::int64_t cost = std::clamp<std::int64_t>(avg, 1, quantum * kMaxCostQuanta);
+            if (cost > flow->deficit_ns) {
+                break;
+            }
+            if (!tenant_enter(tenant, max_inflight)) {
+                at_limit = true;
+                break;
+            }
+            WorkerTask *task = flow->head;
+            flow->head = task->next;
+            if (!flow->head) flow->tail = nullptr;
+            task->next = nullptr;
+            size_--;
+            __atomic_sub_fetch(&tenant->waiting, 1, __ATOMIC_RELAXED);
+            const FairSubmit rc = submit(ctx, task);
+            if (rc == FairSubmit::Full) {
+                tenant_leave(tenant);
+                task->next = flow->head;
+                flow->head = task;
+                if (!flow->tail) flow->tail = task;
+                size_++;
+                __atomic_add_fetch(&tenant->waiting, 1, __ATOMIC_RELAXED);
+                return false; // keeps its turn and credit
+            }
+            if (rc == FairSubmit::Dropped) {
+                tenant_leave(tenant);
+                delete task;
+                continue;
+            }
+            flow->deficit_ns -= cost;
+            sent = true;
+        }
+        blocked = sent ? 0 : blocked + (at_limit ? 1 : 0);
+        flow->in_turn = false;
+        if (!flow->head) {
+            unlink_front();
+        } else {
+            rotate();
+        }
+    }
+    return true;
+}
+
+} // namespace mail
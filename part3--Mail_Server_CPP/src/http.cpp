@@ -2,33 +2,89 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
-int http_request_init(http_request_t *req) {
+#define COMMON_HEADERS \
+    "Server: MailServer/0.1\r\n" \
+    "Access-Control-Allow-Origin: *\r\n" \
+    "Access-Control-Allow-Headers: Authorization, Content-Type\r\n" \
+    "Access-Control-Allow-Methods: GET, POST, PUT, DELETE, OPTIONS\r\n"
+
+#define HEADER_BLOCK(content_type) \
+    { COMMON_HEADERS content_type, sizeof(COMMON_HEADERS content_type) - 1 }
+
+static const http_header_block_t header_blocks[HTTP_HEADERS_COUNT] = {
+    HEADER_BLOCK(""),
+    HEADER_BLOCK("Content-Type: application/json; charset=utf-8\r\n"),
+    HEADER_BLOCK("Content-Type: text/html; charset=utf-8\r\n"),
+    HEADER_BLOCK("Content-Type: text/css; charset=utf-8\r\n"),
+    HEADER_BLOCK("Content-Type: application/javascript; charset=utf-8\r\n"),
+    HEADER_BLOCK("Content-Type: image/png\r\n"),
+    HEADER_BLOCK("Content-Type: image/jpeg\r\n"),
+    HEADER_BLOCK("Content-Type: image/svg+xml\r\n"),
+    HEADER_BLOCK("Content-Type: image/gif\r\n"),
+    HEADER_BLOCK("Content-Type: application/octet-stream\r\n"),
+};
+
+// A few slots so a reader copying one line is never overwritten by the next
+// refresh; the writer publishes a slot only after formatting it.
+#define DATE_SLOTS 4
+static char date_lines[DATE_SLOTS][HTTP_DATE_LINE_LEN + 1];
+static unsigned date_current;
+static long long date_second = -1;
+
+http_request_t *http_request_new(size_t arena_len) {
+    http_request_t *req = (http_request_t *)malloc(sizeof(*req) + arena_len + 1);
+    if (!req) return NULL;
     memset(req, 0, sizeof(*req));
     req->method = HTTP_UNKNOWN;
-    req->body = NULL;
-    return 0;
+    req->path = "";
+    req->version = "";
+    req->arena = (char *)(req + 1);
+    req->arena_len = arena_len;
+    req->arena[arena_len] = '\0';
+    req->body.fd = -1;
+    return req;
 }
 
-void http_request_reset(http_request_t *req) {
-    for (size_t i = 0; i < req->header_count; ++i) {
-        req->headers[i].name[0] = '\0';
-        req->headers[i].value[0] = '\0';
+void http_request_destroy(http_request_t *req) {
+    if (!req) return;
+    if (req->body.mapped) {
+        munmap(req->body.data, req->body.length + 1);
+    } else {
+        free(req->body.data);
     }
-    req->header_count = 0;
-    req->content_length = 0;
-    if (req->body) {
-        free(req->body);
-        req->body = NULL;
+    if (req->body.fd >= 0) {
+        close(req->body.fd);
     }
-    req->method = HTTP_UNKNOWN;
-    req->path[0] = '\0';
-    strcpy(req->version, "HTTP/1.1");
+    free(req);
+}
+
+const char *http_request_body(http_request_t *req) {
+    http_body_t *body = &req->body;
+    if (body->data || body->fd < 0 || body->length == 0) {
+        return body->data;
+    }
+    // The spool file ends with a NUL after the body, so the mapping is a
+    // C string like an in-memory body.
+    void *map = mmap(NULL, body->length + 1, PROT_READ, MAP_PRIVATE, body->fd, 0);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    body->data = static_cast<char *>(map);
+    body->mapped = 1;
+    return body->data;
 }
 
-void http_request_free(http_request_t *req) {
-    if (req->body) free(req->body);
-    req->body = NULL;
+const char *http_request_header_name(const http_request_t *req, size_t i) {
+    return req->arena + req->headers[i].name;
+}
+
+const char *http_request_header_value(const http_request_t *req, size_t i) {
+    return req->arena + req->headers[i].value;
 }
 
 int http_response_init(http_response_t *res) {
@@ -40,16 +96,18 @@ int http_response_init(http_response_t *res) {
 }
 
 void http_response_reset(http_response_t *res) {
-    for (size_t i = 0; i < res->header_count; ++i) {
-        res->headers[i].name[0] = '\0';
-        res->headers[i].value[0] = '\0';
-    }
-    res->header_count = 0;
+    free(res->extra_headers);
+    res->extra_headers = NULL;
+    res->extra_headers_len = 0;
+    res->header_block = NULL;
     if (res->body) {
         free(res->body);
         res->body = NULL;
     }
     res->body_length = 0;
+    res->body_capacity = 0;
+    res->chunked = 0;
+    res->cacheable = 0;
     res->status_code = 200;
     strcpy(res->status_text, "OK");
     res->keep_alive = 1;
@@ -58,30 +116,140 @@ void http_response_reset(http_response_t *res) {
 void http_response_free(http_response_t *res) {
     if (res->body) free(res->body);
     res->body = NULL;
+    res->body_capacity = 0;
+    free(res->extra_headers);
+    res->extra_headers = NULL;
+    res->extra_headers_len = 0;
+}
+
+int http_response_stream_write(http_response_t *res, const char *data, size_t len) {
+    if (res->body_length + len > res->body_capacity) {
+        size_t cap = res->body_capacity ? res->body_capacity : 16384;
+        while (cap < res->body_length + len) cap *= 2;
+        char *grown = static_cast<char *>(realloc(res->body, cap));
+        if (!grown) {
+            return -1;
+        }
+        res->body = grown;
+        res->body_capacity = cap;
+    }
+    memcpy(res->body + res->body_length, data, len);
+    res->body_length += len;
+    http_stream_t *stream = res->stream;
+    if (stream && res->body_length >= stream->flush_bytes) {
+        res->chunked = 1;
+        return stream->flush(stream, res);
+    }
+    return 0;
+}
+
+// Indexed by (length + lowercased first letter) & 15, which is collision-free
+// for the well-known set; a candidate still has to match by name.
+static const struct {
+    const char *name;
+    size_t len;
+    http_header_id_t id;
+} known_headers[16] = {
+    {"Accept-Encoding", 15, HTTP_HDR_ACCEPT_ENCODING},    // 0
+    {"Content-Length", 14, HTTP_HDR_CONTENT_LENGTH},      // 1
+    {NULL, 0, HTTP_HDR_OTHER},
+    {NULL, 0, HTTP_HDR_OTHER},
+    {NULL, 0, HTTP_HDR_OTHER},
+    {"Transfer-Encoding", 17, HTTP_HDR_TRANSFER_ENCODING}, // 5
+    {"If-None-Match", 13, HTTP_HDR_IF_NONE_MATCH},        // 6
+    {"Range", 5, HTTP_HDR_RANGE},                         // 7
+    {NULL, 0, HTTP_HDR_OTHER},
+    {NULL, 0, HTTP_HDR_OTHER},
+    {NULL, 0, HTTP_HDR_OTHER},
+    {"Expect", 6, HTTP_HDR_EXPECT},                       // 11
+    {"Host", 4, HTTP_HDR_HOST},                           // 12
+    {"Connection", 10, HTTP_HDR_CONNECTION},              // 13
+    {"Authorization", 13, HTTP_HDR_AUTHORIZATION},        // 14
+    {"Content-Type", 12, HTTP_HDR_CONTENT_TYPE},          // 15
+};
+
+http_header_id_t http_header_classify(const char *name, size_t len) {
+    if (len == 0) return HTTP_HDR_OTHER;
+    unsigned slot = (unsigned)(len + (unsigned char)(name[0] | 0x20)) & 15;
+    if (known_headers[slot].len == len && strncasecmp(known_headers[slot].name, name, len) == 0) {
+        return known_headers[slot].id;
+    }
+    return HTTP_HDR_OTHER;
+}
+
+const char *http_request_header(const http_request_t *req, http_header_id_t id) {
+    if (id >= HTTP_HDR_KNOWN_COUNT || req->known[id] == 0) return NULL;
+    return req->arena + req->known[id];
 }
 
 const char *http_header_get(const http_request_t *req, const char *name) {
+    http_header_id_t id = http_header_classify(name, strlen(name));
+    if (id != HTTP_HDR_OTHER) {
+        return http_request_header(req, id);
+    }
     for (size_t i = 0; i < req->header_count; ++i) {
-        if (strcasecmp(req->headers[i].name, name) == 0) {
-            return req->headers[i].value;
+        if (strcasecmp(req->arena + req->headers[i].name, name) == 0) {
+            return req->arena + req->headers[i].value;
         }
     }
     return NULL;
 }
 
 void http_response_set_header(http_response_t *res, const char *name, const char *value) {
-    for (size_t i = 0; i < res->header_count; ++i) {
-        if (strcasecmp(res->headers[i].name, name) == 0) {
-            strncpy(res->headers[i].value, value, sizeof(res->headers[i].value)-1);
-            res->headers[i].value[sizeof(res->headers[i].value)-1] = '\0';
-            return;
+    size_t name_len = strlen(name);
+    size_t value_len = strlen(value);
+    // Drop an earlier line for the same header; these are rare and short.
+    char *lines = res->extra_headers;
+    size_t pos = 0;
+    while (pos < res->extra_headers_len) {
+        char *eol = (char *)memchr(lines + pos, '\n', res->extra_headers_len - pos);
+        size_t line_len = (size_t)(eol - (lines + pos)) + 1;
+        if (line_len > name_len && lines[pos + name_len] == ':' &&
+            strncasecmp(lines + pos, name, name_len) == 0) {
+            memmove(lines + pos, lines + pos + line_len, res->extra_headers_len - pos - line_len);
+            res->extra_headers_len -= line_len;
+            continue;
         }
+        pos += line_len;
     }
-    if (res->header_count < MAX_HEADERS) {
-        strncpy(res->headers[res->header_count].name, name, sizeof(res->headers[res->header_count].name)-1);
-        res->headers[res->header_count].name[sizeof(res->headers[res->header_count].name)-1] = '\0';
-        strncpy(res->headers[res->header_count].value, value, sizeof(res->headers[res->header_count].value)-1);
-        res->headers[res->header_count].value[sizeof(res->headers[res->header_count].value)-1] = '\0';
-        res->header_count++;
+    size_t line_len = name_len + 2 + value_len + 2;
+    char *grown = (char *)realloc(res->extra_headers, res->extra_headers_len + line_len);
+    if (!grown) return;
+    char *out = grown + res->extra_headers_len;
+    memcpy(out, name, name_len);
+    memcpy(out + name_len, ": ", 2);
+    memcpy(out + name_len + 2, value, value_len);
+    memcpy(out + name_len + 2 + value_len, "\r\n", 2);
+    res->extra_headers = grown;
+    res->extra_headers_len += line_len;
+}
+
+void http_response_use_headers(http_response_t *res, http_header_set_t set) {
+    res->header_block = &header_blocks[set];
+}
+
+int http_response_compressible(const http_response_t *res) {
+    const http_header_block_t *block = res->header_block;
+    return block == &header_blocks[HTTP_HEADERS_JSON] || block == &header_blocks[HTTP_HEADERS_HTML] ||
+           block == &header_blocks[HTTP_HEADERS_CSS] || block == &header_blocks[HTTP_HEADERS_JS] ||
+           block == &header_blocks[HTTP_HEADERS_SVG];
+}
+
+void http_date_refresh(long long now_ms) {
+    long long second = now_ms / 1000;
+    long long seen = __atomic_load_n(&date_second, __ATOMIC_RELAXED);
+    if (seen == second ||
+        !__atomic_compare_exchange_n(&date_second, &seen, second, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return; // up to date, or another reactor is formatting it
     }
+    unsigned next = (__atomic_load_n(&date_current, __ATOMIC_RELAXED) + 1) % DATE_SLOTS;
+    time_t t = (time_t)second;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(date_lines[next], sizeof(date_lines[next]), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+    __atomic_store_n(&date_current, next, __ATOMIC_RELEASE);
+}
+
+const char *http_date_line(void) {
+    return date_lines[__atomic_load_n(&date_current, __ATOMIC_ACQUIRE)];
 }
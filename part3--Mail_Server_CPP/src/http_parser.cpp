@@ -1,49 +1,367 @@
 #include "http_parser.h"
+#include "http_scan.h"
 #include "util.h"
 
+#include <cerrno>
+#include <cstdint>
 #include <cstring>
 #include <cstdlib>
+#include <fcntl.h>
 #include <strings.h>
-#include <cstdio>
+#include <sys/mman.h>
+#include <unistd.h>
 
-static int parse_request_line(http_request_t *req, const char *line) {
-    char method[16], path[256], version[16];
-    if (sscanf(line, "%15s %255s %15s", method, path, version) != 3) {
+static http_method_t method_from_token(const char *token, size_t len) {
+    switch (len) {
+    case 3:
+        if (memcmp(token, "GET", 3) == 0) return HTTP_GET;
+        if (memcmp(token, "PUT", 3) == 0) return HTTP_PUT;
+        break;
+    case 4:
+        if (memcmp(token, "HEAD", 4) == 0) return HTTP_HEAD;
+        if (memcmp(token, "POST", 4) == 0) return HTTP_POST;
+        break;
+    case 6:
+        if (memcmp(token, "DELETE", 6) == 0) return HTTP_DELETE;
+        break;
+    case 7:
+        if (memcmp(token, "OPTIONS", 7) == 0) return HTTP_OPTIONS;
+        break;
+    }
+    return HTTP_UNKNOWN;
+}
+
+// Cuts the next space-separated token out of [*p, end), NUL-terminating it in
+// place. Returns its start, or NULL if there is none.
+static char *next_token(char **p, char *end, size_t *len) {
+    char *s = *p;
+    while (s < end && *s == ' ') s++;
+    char *e = s;
+    while (e < end && *e != ' ') e++;
+    if (e == s) return NULL;
+    *len = (size_t)(e - s);
+    *p = e < end ? e + 1 : e;
+    *e = '\0';
+    return s;
+}
+
+static int parse_request_line(http_request_t *req, char *line, char *end) {
+    size_t method_len, path_len, version_len;
+    char *method = next_token(&line, end, &method_len);
+    char *path = method ? next_token(&line, end, &path_len) : NULL;
+    char *version = path ? next_token(&line, end, &version_len) : NULL;
+    if (!version) {
         return -1;
     }
-    req->method = HTTP_UNKNOWN;
-    if (strcmp(method, "GET") == 0) req->method = HTTP_GET;
-    else if (strcmp(method, "HEAD") == 0) req->method = HTTP_HEAD;
-    else if (strcmp(method, "POST") == 0) req->method = HTTP_POST;
-    else if (strcmp(method, "PUT") == 0) req->method = HTTP_PUT;
-    else if (strcmp(method, "DELETE") == 0) req->method = HTTP_DELETE;
-    else if (strcmp(method, "OPTIONS") == 0) req->method = HTTP_OPTIONS;
-    util_strlcpy(req->path, sizeof(req->path), path);
-    util_strlcpy(req->version, sizeof(req->version), version);
+    req->method = method_from_token(method, method_len);
+    req->path = path;
+    req->version = version;
     return 0;
 }
 
-void http_parser_init(http_parser_t *parser) {
-    http_request_init(&parser->request);
+// A repeated header the request's framing or routing depends on: two
+// Content-Length or Transfer-Encoding lines that disagree would let a proxy
+// in front of us frame the stream differently (request smuggling), and a
+// request may carry only one Host (RFC 9112, 3.2).
+static int is_framing_conflict(const http_request_t *req, http_header_id_t id, const char *value) {
+    switch (id) {
+    case HTTP_HDR_HOST:
+        return 1;
+    case HTTP_HDR_CONTENT_LENGTH:
+    case HTTP_HDR_TRANSFER_ENCODING:
+        return strcmp(req->arena + req->known[id], value) != 0;
+    default:
+        return 0;
+    }
+}
+
+// Tokenizes the header block in req->arena in place. Lines end in "\r\n"
+// (a bare "\n" is tolerated); the block ends with an empty line.
+static int parse_head(http_request_t *req) {
+    char *p = req->arena;
+    char *block_end = req->arena + req->arena_len;
+    int first = 1;
+    while (p < block_end) {
+        char *nl = p + http_scan_newline(p, (size_t)(block_end - p));
+        if (nl == block_end) break;
+        char *end = (nl > p && nl[-1] == '\r') ? nl - 1 : nl;
+        *end = '\0';
+        if (first) {
+            if (parse_request_line(req, p, end) != 0) {
+                return -1;
+            }
+            first = 0;
+        } else if (end == p) {
+            break; // blank line: end of headers
+        } else {
+            char *colon = static_cast<char *>(memchr(p, ':', (size_t)(end - p)));
+            if (colon) {
+                char *value = colon + 1;
+                while (value < end && (*value == ' ' || *value == '\t')) value++;
+                char *value_end = end;
+                while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t')) value_end--;
+                *colon = '\0';
+                *value_end = '\0';
+                http_header_id_t id = http_header_classify(p, (size_t)(colon - p));
+                if (id != HTTP_HDR_OTHER) {
+                    if (req->known[id] == 0) {
+                        req->known[id] = (uint32_t)(value - req->arena);
+                    } else if (is_framing_conflict(req, id, value)) {
+                        return -1;
+                    } // otherwise the first occurrence wins
+                } else if (req->header_count < MAX_HEADERS) {
+                    http_header_t *h = &req->headers[req->header_count++];
+                    h->name = (uint32_t)(p - req->arena);
+                    h->name_len = (uint32_t)(colon - p);
+                    h->value = (uint32_t)(value - req->arena);
+                    h->value_len = (uint32_t)(value_end - value);
+                }
+            }
+        }
+        p = nl + 1;
+    }
+    return first ? -1 : 0;
+}
+
+// Strict Content-Length: digits only, no sign, no overflow.
+static int parse_content_length(const char *value, size_t *out) {
+    if (*value == '\0') {
+        return -1;
+    }
+    size_t n = 0;
+    for (const char *p = value; *p; ++p) {
+        if (*p < '0' || *p > '9') {
+            return -1;
+        }
+        size_t digit = (size_t)(*p - '0');
+        if (n > (SIZE_MAX - digit) / 10) {
+            return -1;
+        }
+        n = n * 10 + digit;
+    }
+    *out = n;
+    return 0;
+}
+
+static int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Unlinked from the start, so the file goes away with its last descriptor
+// whatever happens to the request.
+static int open_spool(const char *dir) {
+    if (dir && *dir) {
+        int fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+        if (fd >= 0) {
+            return fd;
+        }
+    }
+    return memfd_create("maild-body", MFD_CLOEXEC);
+}
+
+// Picks where a body of known length goes: memory for small bodies, a
+// spool file past the threshold.
+static int body_begin(http_parser_t *parser, http_request_t *req) {
+    const http_body_limits_t *limits = parser->limits;
+    if (limits && limits->spool_threshold > 0 && req->content_length > limits->spool_threshold) {
+        req->body.fd = open_spool(limits->spool_dir);
+        return req->body.fd >= 0 ? 0 : -1;
+    }
+    req->body.data = static_cast<char*>(std::malloc(req->content_length + 1));
+    if (!req->body.data) {
+        return -1;
+    }
+    parser->body_capacity = req->content_length + 1;
+    return 0;
+}
+
+// Adds body bytes. A chunked body grows in memory until it passes the spool
+// threshold and then moves to a spool file; memory always keeps room for the
+// final NUL.
+static int body_append(http_parser_t *parser, http_request_t *req, const char *data, size_t len) {
+    http_body_t *body = &req->body;
+    const size_t total = body->length + len;
+    if (body->fd < 0 && total + 1 > parser->body_capacity) {
+        const http_body_limits_t *limits = parser->limits;
+        if (limits && limits->spool_threshold > 0 && total > limits->spool_threshold) {
+            body->fd = open_spool(limits->spool_dir);
+            if (body->fd < 0 || write_all(body->fd, body->data, body->length) != 0) {
+                return -1;
+            }
+            std::free(body->data);
+            body->data = NULL;
+            parser->body_capacity = 0;
+        } else {
+            size_t cap = parser->body_capacity ? parser->body_capacity * 2 : 16384;
+            while (cap < total + 1) cap *= 2;
+            char *grown = static_cast<char*>(std::realloc(body->data, cap));
+            if (!grown) {
+                return -1;
+            }
+            body->data = grown;
+            parser->body_capacity = cap;
+        }
+    }
+    if (body->fd >= 0) {
+        if (write_all(body->fd, data, len) != 0) {
+            return -1;
+        }
+    } else {
+        memcpy(body->data + body->length, data, len);
+    }
+    body->length = total;
+    return 0;
+}
+
+// Terminates the body with a NUL, in memory or in the spool file, so
+// http_request_body can hand it out as a string.
+static int body_finish(http_request_t *req) {
+    http_body_t *body = &req->body;
+    if (body->fd >= 0) {
+        return write_all(body->fd, "", 1);
+    }
+    if (body->data) {
+        body->data[body->length] = '\0';
+    }
+    return 0;
+}
+
+static int is_chunked(const char *value) {
+    return strcasecmp(value, "chunked") == 0;
+}
+
+// Size line of a chunk: hex digits, then optional extensions, which are
+// ignored.
+static int parse_chunk_size(const char *line, size_t len, size_t *out) {
+    size_t n = 0;
+    size_t i = 0;
+    for (; i < len; ++i) {
+        int c = (unsigned char)line[i];
+        int digit;
+        if (c >= '0' && c <= '9') digit = c - '0';
+        else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+        else break;
+        if (n > (SIZE_MAX >> 4)) {
+            return -1;
+        }
+        n = (n << 4) | (size_t)digit;
+    }
+    if (i == 0 || (i < len && line[i] != ';' && line[i] != ' ' && line[i] != '\t')) {
+        return -1;
+    }
+    *out = n;
+    return 0;
+}
+
+// Decodes as much of a chunked body as read_buf holds. Size lines, chunk
+// ends and trailers are only consumed once complete, so the decoder resumes
+// at any byte boundary.
+static parse_result_t parse_chunked(http_parser_t *parser, http_request_t *req, byte_buffer_t *read_buf) {
+    const http_body_limits_t *limits = parser->limits;
+    for (;;) {
+        size_t readable = buffer_readable(read_buf);
+        const char *data = buffer_peek(read_buf);
+        if (parser->chunk_state == CHUNK_DATA) {
+            size_t n = parser->chunk_remaining < readable ? parser->chunk_remaining : readable;
+            if (n == 0) {
+                return PARSE_IN_PROGRESS;
+            }
+            if (body_append(parser, req, data, n) != 0) {
+                return PARSE_ERROR;
+            }
+            buffer_consume(read_buf, n);
+            parser->chunk_remaining -= n;
+            parser->body_received += n;
+            if (parser->chunk_remaining == 0) {
+                parser->chunk_state = CHUNK_DATA_END;
+            }
+            continue;
+        }
+
+        size_t nl = http_scan_newline(data, readable);
+        if (nl == readable) {
+            return readable > CHUNK_LINE_MAX ? PARSE_ERROR : PARSE_IN_PROGRESS;
+        }
+        if (nl == 0 || data[nl - 1] != '\r') {
+            return PARSE_ERROR;
+        }
+        const size_t line_len = nl - 1; // without the CRLF
+        switch (parser->chunk_state) {
+        case CHUNK_SIZE: {
+            size_t size = 0;
+            if (parse_chunk_size(data, line_len, &size) != 0) {
+                return PARSE_ERROR;
+            }
+            if (limits && limits->max_body > 0 && size > limits->max_body - parser->body_received) {
+                return PARSE_TOO_LARGE;
+            }
+            parser->chunk_remaining = size;
+            parser->chunk_state = size > 0 ? CHUNK_DATA : CHUNK_TRAILER;
+            break;
+        }
+        case CHUNK_DATA_END:
+            if (line_len != 0) {
+                return PARSE_ERROR;
+            }
+            parser->chunk_state = CHUNK_SIZE;
+            break;
+        default: // CHUNK_TRAILER: fields are skipped up to the empty line
+            if (line_len == 0) {
+                buffer_consume(read_buf, nl + 1);
+                req->content_length = req->body.length;
+                return body_finish(req) == 0 ? PARSE_COMPLETE : PARSE_ERROR;
+            }
+            break;
+        }
+        buffer_consume(read_buf, nl + 1);
+    }
+}
+
+void http_parser_init(http_parser_t *parser, const http_body_limits_t *limits) {
+    parser->limits = limits;
+    parser->request = NULL;
     parser->header_bytes = 0;
+    parser->scanned = 0;
     parser->body_received = 0;
+    parser->body_capacity = 0;
+    parser->chunk_remaining = 0;
+    parser->chunk_state = CHUNK_SIZE;
+    parser->chunked = 0;
     parser->headers_complete = 0;
 }
 
 void http_parser_reset(http_parser_t *parser) {
-    http_request_reset(&parser->request);
+    http_request_destroy(parser->request);
+    parser->request = NULL;
     parser->header_bytes = 0;
+    parser->scanned = 0;
     parser->body_received = 0;
+    parser->body_capacity = 0;
+    parser->chunk_remaining = 0;
+    parser->chunk_state = CHUNK_SIZE;
+    parser->chunked = 0;
     parser->headers_complete = 0;
 }
 
-static char *find_double_crlf(const char *data, size_t len) {
-    for (size_t i = 0; i + 3 < len; ++i) {
-        if (data[i] == '\r' && data[i+1] == '\n' && data[i+2] == '\r' && data[i+3] == '\n') {
-            return (char *)(data + i);
-        }
-    }
-    return NULL;
+void http_parser_free(http_parser_t *parser) {
+    http_parser_reset(parser);
+}
+
+http_request_t *http_parser_take_request(http_parser_t *parser) {
+    http_request_t *req = parser->request;
+    parser->request = NULL;
+    http_parser_reset(parser);
+    return req;
 }
 
 parse_result_t http_parser_execute(http_parser_t *parser, byte_buffer_t *read_buf) {
@@ -54,64 +372,82 @@ parse_result_t http_parser_execute(http_parser_t *parser, byte_buffer_t *read_bu
 
     const char *data = buffer_peek(read_buf);
     if (!parser->headers_complete) {
-        char *header_end = find_double_crlf(data, readable);
-        if (!header_end) {
+        // Nothing is consumed until the block is complete, so a trickled
+        // header block is searched only once from where the last call ended.
+        size_t header_len = http_scan_header_end(data, readable, parser->scanned);
+        const http_body_limits_t *limits = parser->limits;
+        const size_t max_header = limits ? limits->max_header : 0;
+        if (header_len == 0) {
+            if (max_header > 0 && readable > max_header) {
+                return PARSE_HEADER_TOO_LARGE;
+            }
+            parser->scanned = readable;
             return PARSE_IN_PROGRESS;
         }
-        size_t header_len = (header_end - data) + 4;
-    char *headers = static_cast<char*>(std::malloc(header_len + 1));
-        memcpy(headers, data, header_len);
-        headers[header_len] = '\0';
-
-        char *saveptr;
-        char *line = strtok_r(headers, "\r\n", &saveptr);
-        if (!line || parse_request_line(&parser->request, line) != 0) {
-            std::free(headers);
+        if (max_header > 0 && header_len > max_header) {
+            return PARSE_HEADER_TOO_LARGE;
+        }
+        // The header block leaves the read buffer as one segment, which
+        // becomes the request's arena; everything after it is body or the
+        // next pipelined request.
+        http_request_t *req = http_request_new(header_len);
+        if (!req) {
+            return PARSE_ERROR;
+        }
+        memcpy(req->arena, data, header_len);
+        parser->request = req;
+        if (parse_head(req) != 0) {
             return PARSE_ERROR;
         }
 
-        while ((line = strtok_r(NULL, "\r\n", &saveptr))) {
-            if (*line == '\0') break;
-            char *colon = strchr(line, ':');
-            if (!colon) continue;
-            *colon = '\0';
-            char *value = colon + 1;
-            while (*value == ' ') value++;
-            if (parser->request.header_count < MAX_HEADERS) {
-        util_strlcpy(parser->request.headers[parser->request.header_count].name,
-                 sizeof(parser->request.headers[parser->request.header_count].name), line);
-        util_strlcpy(parser->request.headers[parser->request.header_count].value,
-                 sizeof(parser->request.headers[parser->request.header_count].value), value);
-                parser->request.header_count++;
+        const char *cl = http_request_header(req, HTTP_HDR_CONTENT_LENGTH);
+        if (cl && parse_content_length(cl, &req->content_length) != 0) {
+            return PARSE_ERROR;
+        }
+        // Chunked is the only transfer coding we decode. A request that
+        // also has Content-Length is ambiguous and refused outright.
+        const char *te = http_request_header(req, HTTP_HDR_TRANSFER_ENCODING);
+        if (te) {
+            if (cl || !is_chunked(te)) {
+                return PARSE_ERROR;
             }
+            parser->chunked = 1;
+        }
+        if (limits && limits->max_body > 0 && req->content_length > limits->max_body) {
+            return PARSE_TOO_LARGE;
         }
-
-        const char *cl = http_header_get(&parser->request, "Content-Length");
-        if (cl) parser->request.content_length = (size_t)atoi(cl);
         parser->headers_complete = 1;
         parser->header_bytes = header_len;
         parser->body_received = 0;
         buffer_consume(read_buf, header_len);
-    std::free(headers);
         readable = buffer_readable(read_buf);
         data = buffer_peek(read_buf);
+        // Give the caller a chance to answer before the client uploads the
+        // rest; a body that is already here is simply read.
+        if (parser->chunked || readable < req->content_length) {
+            return PARSE_HEADERS;
+        }
     }
 
-    if (parser->headers_complete) {
-        size_t to_copy = parser->request.content_length - parser->body_received;
-        if (to_copy > readable) to_copy = readable;
-        if (to_copy > 0) {
-            if (!parser->request.body) {
-                parser->request.body = static_cast<char*>(std::malloc(parser->request.content_length + 1));
-                parser->request.body[parser->request.content_length] = '\0';
-            }
-            memcpy(parser->request.body + parser->body_received, data, to_copy);
-            parser->body_received += to_copy;
-            buffer_consume(read_buf, to_copy);
+    http_request_t *req = parser->request;
+    if (parser->chunked) {
+        return parse_chunked(parser, req, read_buf);
+    }
+    size_t to_copy = req->content_length - parser->body_received;
+    if (to_copy > readable) to_copy = readable;
+    if (to_copy > 0) {
+        http_body_t *body = &req->body;
+        if (!body->data && body->fd < 0 && body_begin(parser, req) != 0) {
+            return PARSE_ERROR;
         }
-        if (parser->body_received == parser->request.content_length) {
-            return PARSE_COMPLETE;
+        if (body_append(parser, req, data, to_copy) != 0) {
+            return PARSE_ERROR;
         }
+        parser->body_received += to_copy;
+        buffer_consume(read_buf, to_copy);
+    }
+    if (parser->body_received < req->content_length) {
+        return PARSE_IN_PROGRESS;
     }
-    return PARSE_IN_PROGRESS;
+    return body_finish(req) == 0 ? PARSE_COMPLETE : PARSE_ERROR;
 }
@@ -0,0 +1,83 @@
+#include "http_scan.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_SCAN_X86 1
+#endif
+
+typedef size_t (*newline_fn)(const char *data, size_t len);
+
+static size_t newline_scalar(const char *data, size_t len) {
+    const void *hit = memchr(data, '\n', len);
+    return hit ? (size_t)(static_cast<const char *>(hit) - data) : len;
+}
+
+#ifdef HTTP_SCAN_X86
+static size_t newline_sse2(const char *data, size_t len) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, nl));
+        if (mask) return i + (size_t)__builtin_ctz(mask);
+    }
+    return i + newline_scalar(data + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t newline_avx2(const char *data, size_t len) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, nl));
+        if (mask) return i + (size_t)__builtin_ctz(mask);
+    }
+    return i + newline_sse2(data + i, len - i);
+}
+#endif
+
+static const char *kernel_name = "scalar";
+
+static newline_fn pick_kernel(void) {
+#ifdef HTTP_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernel_name = "avx2";
+        return newline_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        kernel_name = "sse2";
+        return newline_sse2;
+    }
+#endif
+    return newline_scalar;
+}
+
+// Resolved once during static initialization, before any thread starts.
+static const newline_fn newline_impl = pick_kernel();
+
+size_t http_scan_newline(const char *data, size_t len) {
+    return newline_impl(data, len);
+}
+
+size_t http_scan_header_end(const char *data, size_t len, size_t from) {
+    // A terminator ending in the new bytes may start up to 3 bytes earlier.
+    size_t i = from > 3 ? from - 3 : 0;
+    while (i < len) {
+        size_t nl = i + http_scan_newline(data + i, len - i);
+        if (nl >= len) break;
+        // Every terminator has a '\n' at its second byte: "\r[\n]\r\n".
+        if (nl >= 1 && nl + 2 < len && data[nl - 1] == '\r' && data[nl + 1] == '\r' && data[nl + 2] == '\n') {
+            return nl + 3;
+        }
+        i = nl + 1;
+    }
+    return 0;
+}
+
+const char *http_scan_kernel(void) {
+    return kernel_name;
+}
@@ -0,0 +1,75 @@
+#include "job_ring.h"
+
+#include <cstdlib>
+
+int job_ring_init(job_ring_t *r, size_t capacity) {
+    size_t cap = 2;
+    while (cap < capacity) cap <<= 1;
+    r->cells = static_cast<job_ring_cell_t*>(std::calloc(cap, sizeof(job_ring_cell_t)));
+    if (!r->cells) return -1;
+    for (size_t i = 0; i < cap; ++i) {
+        r->cells[i].seq = i;
+    }
+    r->mask = cap - 1;
+    r->tail = 0;
+    r->head = 0;
+    return 0;
+}
+
+void job_ring_destroy(job_ring_t *r) {
+    std::free(r->cells);
+    r->cells = NULL;
+}
+
+int job_ring_push(job_ring_t *r, tp_job_t job) {
+    uint64_t pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+    job_ring_cell_t *cell;
+    for (;;) {
+        cell = &r->cells[pos & r->mask];
+        uint64_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t)(seq - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&r->tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1; // a consumer has not freed this cell yet
+        } else {
+            pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+        }
+    }
+    cell->job = job;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int job_ring_pop(job_ring_t *r, tp_job_t *out) {
+    uint64_t pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    job_ring_cell_t *cell;
+    for (;;) {
+        cell = &r->cells[pos & r->mask];
+        uint64_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t)(seq - (pos + 1));
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&r->head, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1; // no producer has filled this cell yet
+        } else {
+            pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+        }
+    }
+    *out = cell->job;
+    // Free the cell for the producer one lap ahead.
+    __atomic_store_n(&cell->seq, pos + r->mask + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+size_t job_ring_size(const job_ring_t *r) {
+    uint64_t head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    uint64_t tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+    return tail > head ? (size_t)(tail - head) : 0;
+}
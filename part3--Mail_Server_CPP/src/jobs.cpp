@@ -1,13 +1,21 @@
 #include "jobs.h"
+#include "util.h"
+
+#include <cstdlib>
 
 namespace mail {
 
-WorkerTask::WorkerTask() {
-    http_request_init(&request);
-}
+WorkerTask::WorkerTask() = default;
 
 WorkerTask::~WorkerTask() {
-    http_request_free(&request);
+    http_request_destroy(request);
+    conn_token_unref(token);
+    if (tenant) {
+        if (started_ns) {
+            tenant_job_done(tenant, util_now_ns() - started_ns - paused_ns);
+        }
+        runtime->tenants->release(tenant);
+    }
 }
 
 WorkerResponse::WorkerResponse() {
@@ -15,6 +23,8 @@ WorkerResponse::WorkerResponse() {
 }
 
 WorkerResponse::~WorkerResponse() {
+    delete next_part;
+    std::free(wire_head);
     http_response_free(&response);
 }
 
@@ -3,10 +3,11 @@
 #include "logger.h"
 #include "thread_pool.h"
 #include "server.h"
-#include "jobs.h"
 #include "services/auth_service.h"
 #include "services/mail_service.h"
 #include "template_engine.h"
+#include "compress.h"
+#include "fair_queue.h"
 #include "db.h"
 
 #include <csignal>
@@ -20,26 +21,6 @@ struct LoggerGuard {
     ~LoggerGuard() { logger_close(); }
 };
 
-struct ResponseQueueGuard {
-    explicit ResponseQueueGuard(concurrent_queue_t &queue)
-        : queue_(queue), initialized_(cq_init(&queue_) == 0) {}
-
-    ResponseQueueGuard(const ResponseQueueGuard &) = delete;
-    ResponseQueueGuard &operator=(const ResponseQueueGuard &) = delete;
-
-    ~ResponseQueueGuard() {
-        if (initialized_) {
-            cq_destroy(&queue_, worker_response_dispose);
-        }
-    }
-
-    bool ok() const noexcept { return initialized_; }
-
-private:
-    concurrent_queue_t &queue_;
-    bool initialized_;
-};
-
 void handle_sigint(int signo) {
     (void)signo;
 }
@@ -65,9 +46,20 @@ int main(int argc, char *argv[]) {
     logger_set_level(LOG_DEBUG);
     LoggerGuard logger_guard;
 
+    // Outlives the pool: tasks still draining out of it hold tenants.
+    mail::TenantTable tenants;
+    runtime.tenants = &tenants;
+
     thread_pool_config_t pool_cfg{};
     pool_cfg.thread_count = runtime.config.thread_pool_size;
-    pool_cfg.queue_capacity = runtime.config.thread_pool_size * 4;
+    pool_cfg.queue_capacity = runtime.config.pool_queue_capacity
+        ? runtime.config.pool_queue_capacity
+        : runtime.config.thread_pool_size * 4;
+    pool_cfg.queue = runtime.config.pool_queue == mail::PoolQueue::Mpmc ? TP_QUEUE_MPMC : TP_QUEUE_MUTEX;
+    pool_cfg.reserved = runtime.config.pool_reserved_workers;
+    pool_cfg.weights[TP_CLASS_INTERACTIVE] = runtime.config.pool_weight_interactive;
+    pool_cfg.weights[TP_CLASS_BULK] = runtime.config.pool_weight_bulk;
+    pool_cfg.weights[TP_CLASS_BACKGROUND] = runtime.config.pool_weight_background;
     pool_cfg.on_error = NULL;
 
     using ThreadPoolPtr = std::unique_ptr<thread_pool_t, decltype(&thread_pool_destroy)>;
@@ -79,13 +71,6 @@ int main(int argc, char *argv[]) {
     runtime.pool = pool.get();
     LOGI("thread pool ready with %zu threads", runtime.config.thread_pool_size);
 
-    ResponseQueueGuard response_queue_guard(runtime.response_queue);
-    if (!response_queue_guard.ok()) {
-        LOGF("failed to init response queue");
-        return 1;
-    }
-    LOGI("response queue initialized");
-
     db_handle_t *db_raw = nullptr;
     if (db_init(runtime.config, &db_raw) != 0) {
         LOGF("failed to initialize database backend");
@@ -99,18 +84,23 @@ int main(int argc, char *argv[]) {
     using AuthPtr = std::unique_ptr<auth_context_t, decltype(&auth_service_destroy)>;
     using MailPtr = std::unique_ptr<mail_service_t, decltype(&mail_service_destroy)>;
     using TemplatePtr = std::unique_ptr<template_engine_t, decltype(&template_engine_destroy)>;
+    using CompressorPtr = std::unique_ptr<compressor_t, decltype(&compressor_destroy)>;
 
     AuthPtr auth(auth_service_create(runtime.db), auth_service_destroy);
     MailPtr mail(mail_service_create(runtime.db, runtime.config), mail_service_destroy);
     TemplatePtr templates(template_engine_create(runtime.config.template_dir.string().c_str()), template_engine_destroy);
+    const compress_config_t compress_cfg{runtime.config.compression_level, runtime.config.compression_static_level,
+                                         runtime.config.compression_min_bytes, runtime.config.compression_cache_bytes};
+    CompressorPtr compressor(compressor_create(&compress_cfg), compressor_destroy);
 
-    if (!auth || !mail || !templates) {
+    if (!auth || !mail || !templates || !compressor) {
         LOGF("failed to initialize services");
         return 1;
     }
     runtime.auth = auth.get();
     runtime.mail = mail.get();
     runtime.templates = templates.get();
+    runtime.compression = compressor.get();
     LOGI("auth/mail/template services initialized");
 
     std::signal(SIGINT, handle_sigint);
@@ -121,6 +111,7 @@ int main(int argc, char *argv[]) {
 
     LOGI("server_run exited with code %d", rc);
 
+    runtime.compression = nullptr;
     runtime.templates = nullptr;
     runtime.mail = nullptr;
     runtime.auth = nullptr;
@@ -0,0 +1,54 @@
+#include "mpsc_queue.h"
+
+void mpsc_queue_init(mpsc_queue_t *q) {
+    q->stub.next = NULL;
+    q->head = &q->stub;
+    q->tail = &q->stub;
+}
+
+void mpsc_queue_push(mpsc_queue_t *q, mpsc_node_t *node) {
+    __atomic_store_n(&node->next, (mpsc_node_t *)NULL, __ATOMIC_RELAXED);
+    mpsc_node_t *prev = __atomic_exchange_n(&q->head, node, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+}
+
+mpsc_node_t *mpsc_queue_pop(mpsc_queue_t *q) {
+    mpsc_node_t *tail = q->tail;
+    mpsc_node_t *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (tail == &q->stub) {
+        if (!next) return NULL;
+        q->tail = next;
+        tail = next;
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    }
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+    // tail is the last linked node. Unless a push is half done, put the stub
+    // behind it so tail can be handed out.
+    if (tail != __atomic_load_n(&q->head, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    mpsc_queue_push(q, &q->stub);
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+size_t mpsc_queue_pop_batch(mpsc_queue_t *q, mpsc_node_t **out, size_t max) {
+    size_t n = 0;
+    while (n < max) {
+        mpsc_node_t *node = mpsc_queue_pop(q);
+        if (!node) break;
+        out[n++] = node;
+    }
+    return n;
+}
+
+int mpsc_queue_empty(const mpsc_queue_t *q) {
+    return q->tail == &q->stub && __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == &q->stub;
+}
@@ -0,0 +1,76 @@
+#include "mpsc_ring.h"
+
+#include <cstdlib>
+
+int mpsc_ring_init(mpsc_ring_t *r, size_t capacity) {
+    size_t cap = 2;
+    while (cap < capacity) cap <<= 1;
+    r->cells = static_cast<mpsc_ring_cell_t*>(std::calloc(cap, sizeof(mpsc_ring_cell_t)));
+    if (!r->cells) return -1;
+    for (size_t i = 0; i < cap; ++i) {
+        r->cells[i].seq = i;
+    }
+    r->mask = cap - 1;
+    r->tail = 0;
+    r->head = 0;
+    return 0;
+}
+
+void mpsc_ring_destroy(mpsc_ring_t *r, void (*free_fn)(void *)) {
+    if (!r->cells) return;
+    void *data;
+    while ((data = mpsc_ring_pop(r)) != NULL) {
+        if (free_fn) free_fn(data);
+    }
+    std::free(r->cells);
+    r->cells = NULL;
+}
+
+int mpsc_ring_push(mpsc_ring_t *r, void *data) {
+    uint64_t pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+    mpsc_ring_cell_t *cell;
+    for (;;) {
+        cell = &r->cells[pos & r->mask];
+        uint64_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t)(seq - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&r->tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1; // the consumer has not freed this cell yet
+        } else {
+            pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+        }
+    }
+    cell->data = data;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void *mpsc_ring_pop(mpsc_ring_t *r) {
+    mpsc_ring_cell_t *cell = &r->cells[r->head & r->mask];
+    if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != r->head + 1) {
+        return NULL;
+    }
+    void *data = cell->data;
+    __atomic_store_n(&cell->seq, r->head + r->mask + 1, __ATOMIC_RELEASE);
+    r->head++;
+    return data;
+}
+
+size_t mpsc_ring_pop_batch(mpsc_ring_t *r, void **out, size_t max) {
+    size_t n = 0;
+    while (n < max) {
+        void *data = mpsc_ring_pop(r);
+        if (!data) break;
+        out[n++] = data;
+    }
+    return n;
+}
+
+int mpsc_ring_empty(const mpsc_ring_t *r) {
+    const mpsc_ring_cell_t *cell = &r->cells[r->head & r->mask];
+    return __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != r->head + 1;
+}
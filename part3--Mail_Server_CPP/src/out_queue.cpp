@@ -0,0 +1,166 @@
+#include "out_queue.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <sys/socket.h>
+
+void out_queue_init(out_queue_t *q, buffer_pool_t *pool, size_t staging_cap) {
+    memset(q, 0, sizeof(*q));
+    q->pool = pool;
+    q->staging_cap = staging_cap;
+}
+
+void out_queue_free(out_queue_t *q) {
+    for (size_t i = q->seg_head; i < q->seg_count; ++i) {
+        std::free(q->segs[i].owned);
+    }
+    std::free(q->segs);
+    buffer_pool_release(q->pool, &q->staging);
+    memset(q, 0, sizeof(*q));
+}
+
+size_t out_queue_pending(const out_queue_t *q) {
+    return q->pending;
+}
+
+static out_segment_t *push_segment(out_queue_t *q) {
+    if (q->seg_count == q->seg_cap) {
+        if (q->seg_head > 0) {
+            // Slide the live segments down before growing.
+            memmove(q->segs, q->segs + q->seg_head, (q->seg_count - q->seg_head) * sizeof(out_segment_t));
+            q->seg_count -= q->seg_head;
+            q->seg_head = 0;
+        } else {
+            size_t cap = q->seg_cap ? q->seg_cap * 2 : 8;
+            out_segment_t *segs = static_cast<out_segment_t*>(std::realloc(q->segs, cap * sizeof(out_segment_t)));
+            if (!segs) return NULL;
+            q->segs = segs;
+            q->seg_cap = cap;
+        }
+    }
+    out_segment_t *seg = &q->segs[q->seg_count++];
+    memset(seg, 0, sizeof(*seg));
+    return seg;
+}
+
+int out_queue_append_copy(out_queue_t *q, const char *data, size_t len) {
+    if (len == 0) return 0;
+    byte_buffer_t *staging = out_queue_staging(q);
+    if (!staging) return -1;
+    size_t offset = staging->wpos;
+    if (buffer_append(staging, data, len) != 0) {
+        return -1;
+    }
+    return out_queue_commit_staged(q, offset);
+}
+
+byte_buffer_t *out_queue_staging(out_queue_t *q) {
+    if (buffer_pool_attach(q->pool, &q->staging, q->staging_cap) != 0) {
+        return NULL;
+    }
+    return &q->staging;
+}
+
+int out_queue_commit_staged(out_queue_t *q, size_t offset) {
+    size_t len = q->staging.wpos - offset;
+    if (len == 0) return 0;
+    // Extend the last segment when it ends right where these bytes begin.
+    if (q->seg_count > q->seg_head) {
+        out_segment_t *last = &q->segs[q->seg_count - 1];
+        if (!last->data && last->offset + last->len == offset) {
+            last->len += len;
+            q->pending += len;
+            return 0;
+        }
+    }
+    out_segment_t *seg = push_segment(q);
+    if (!seg) return -1;
+    seg->offset = offset;
+    seg->len = len;
+    q->pending += len;
+    return 0;
+}
+
+int out_queue_append_owned(out_queue_t *q, char *owned, const char *data, size_t len) {
+    if (len == 0) {
+        std::free(owned);
+        return 0;
+    }
+    out_segment_t *seg = push_segment(q);
+    if (!seg) {
+        std::free(owned);
+        return -1;
+    }
+    seg->data = data;
+    seg->len = len;
+    seg->owned = owned;
+    q->pending += len;
+    return 0;
+}
+
+int out_queue_append_ref(out_queue_t *q, const char *data, size_t len) {
+    return out_queue_append_owned(q, NULL, data, len);
+}
+
+size_t out_queue_iov(const out_queue_t *q, struct iovec *iov, size_t max) {
+    size_t n = 0;
+    for (size_t i = q->seg_head; i < q->seg_count && n < max; ++i) {
+        const out_segment_t *seg = &q->segs[i];
+        const char *base = seg->data ? seg->data : q->staging.data + seg->offset;
+        size_t skip = (i == q->seg_head) ? q->head_sent : 0;
+        iov[n].iov_base = const_cast<char *>(base + skip);
+        iov[n].iov_len = seg->len - skip;
+        ++n;
+    }
+    return n;
+}
+
+void out_queue_consume(out_queue_t *q, size_t n) {
+    if (n > q->pending) n = q->pending;
+    q->pending -= n;
+    while (n > 0 && q->seg_head < q->seg_count) {
+        out_segment_t *seg = &q->segs[q->seg_head];
+        size_t left = seg->len - q->head_sent;
+        if (n < left) {
+            q->head_sent += n;
+            return;
+        }
+        n -= left;
+        std::free(seg->owned);
+        seg->owned = NULL;
+        q->head_sent = 0;
+        q->seg_head++;
+    }
+    if (q->seg_head == q->seg_count) {
+        q->seg_head = q->seg_count = 0;
+        q->head_sent = 0;
+        buffer_pool_release(q->pool, &q->staging);
+    }
+}
+
+ssize_t out_queue_writev(out_queue_t *q, int fd) {
+    size_t total = 0;
+    while (q->pending > 0) {
+        struct iovec iov[OUT_QUEUE_IOV_MAX];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = out_queue_iov(q, iov, OUT_QUEUE_IOV_MAX);
+        size_t offered = 0;
+        for (size_t i = 0; i < msg.msg_iovlen; ++i) {
+            offered += iov[i].iov_len;
+        }
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n <= 0) {
+            // A later call sees the error again; report what went out first.
+            return total > 0 ? (ssize_t)total : n;
+        }
+        out_queue_consume(q, (size_t)n);
+        total += (size_t)n;
+        if ((size_t)n < offered) {
+            break; // the socket is full; wait for the next EPOLLOUT edge
+        }
+    }
+    return (ssize_t)total;
+}
@@ -19,6 +19,7 @@
 #include <strings.h>
 
 #define JSON_TOKEN_COUNT 768
+#define ROUTER_PATH_MAX 1024 // longer paths are cut before routing
 
 namespace mail {
 
@@ -129,16 +130,8 @@ static char *jw_detach(json_writer_t *jw, size_t *length) {
     return out;
 }
 
-static void set_common_headers(http_response_t *res) {
-    http_response_set_header(res, "Server", "MailServer/0.1");
-    http_response_set_header(res, "Access-Control-Allow-Origin", "*");
-    http_response_set_header(res, "Access-Control-Allow-Headers", "Authorization, Content-Type");
-    http_response_set_header(res, "Access-Control-Allow-Methods", "GET, POST, PUT, DELETE, OPTIONS");
-}
-
 static void respond_with_json_writer(http_response_t *res, int status_code, const char *status_text, json_writer_t *jw) {
-    set_common_headers(res);
-    http_response_set_header(res, "Content-Type", "application/json; charset=utf-8");
+    http_response_use_headers(res, HTTP_HEADERS_JSON);
     res->status_code = status_code;
     strncpy(res->status_text, status_text, sizeof(res->status_text) - 1);
     res->status_text[sizeof(res->status_text) - 1] = '\0';
@@ -260,13 +253,13 @@ static void respond_with_template(ServerRuntime *rt, http_response_t *res, const
         respond_with_error(res, 500, "template_error", "Failed to render template");
         return;
     }
-    set_common_headers(res);
-    http_response_set_header(res, "Content-Type", "text/html; charset=utf-8");
+    http_response_use_headers(res, HTTP_HEADERS_HTML);
     res->status_code = 200;
     strncpy(res->status_text, "OK", sizeof(res->status_text) - 1);
     res->status_text[sizeof(res->status_text) - 1] = '\0';
     res->body = html;
     res->body_length = len;
+    res->cacheable = 1;
 }
 
 static int is_safe_segment(const char *s) {
@@ -353,19 +346,19 @@ static int read_file_all(const char *path, char **out_buf, size_t *out_len) {
     return 0;
 }
 
-static const char *mime_from_path(const char *path) {
+static http_header_set_t headers_from_path(const char *path) {
     const char *ext = strrchr(path, '.');
-    if (!ext) return "application/octet-stream";
+    if (!ext) return HTTP_HEADERS_OCTET;
     ext++;
-    if (strcasecmp(ext, "html") == 0) return "text/html; charset=utf-8";
-    if (strcasecmp(ext, "css") == 0) return "text/css; charset=utf-8";
-    if (strcasecmp(ext, "js") == 0) return "application/javascript; charset=utf-8";
-    if (strcasecmp(ext, "json") == 0) return "application/json; charset=utf-8";
-    if (strcasecmp(ext, "png") == 0) return "image/png";
-    if (strcasecmp(ext, "jpg") == 0 || strcasecmp(ext, "jpeg") == 0) return "image/jpeg";
-    if (strcasecmp(ext, "svg") == 0) return "image/svg+xml";
-    if (strcasecmp(ext, "gif") == 0) return "image/gif";
-    return "application/octet-stream";
+    if (strcasecmp(ext, "html") == 0) return HTTP_HEADERS_HTML;
+    if (strcasecmp(ext, "css") == 0) return HTTP_HEADERS_CSS;
+    if (strcasecmp(ext, "js") == 0) return HTTP_HEADERS_JS;
+    if (strcasecmp(ext, "json") == 0) return HTTP_HEADERS_JSON;
+    if (strcasecmp(ext, "png") == 0) return HTTP_HEADERS_PNG;
+    if (strcasecmp(ext, "jpg") == 0 || strcasecmp(ext, "jpeg") == 0) return HTTP_HEADERS_JPEG;
+    if (strcasecmp(ext, "svg") == 0) return HTTP_HEADERS_SVG;
+    if (strcasecmp(ext, "gif") == 0) return HTTP_HEADERS_GIF;
+    return HTTP_HEADERS_OCTET;
 }
 
 static void respond_with_static(ServerRuntime *rt, http_response_t *res, const char *rel_path) {
@@ -396,17 +389,17 @@ static void respond_with_static(ServerRuntime *rt, http_response_t *res, const c
         respond_with_error(res, 404, "not_found", "Static asset not found");
         return;
     }
-    set_common_headers(res);
-    http_response_set_header(res, "Content-Type", mime_from_path(fullpath));
+    http_response_use_headers(res, headers_from_path(fullpath));
     res->status_code = 200;
     strncpy(res->status_text, "OK", sizeof(res->status_text) - 1);
     res->status_text[sizeof(res->status_text) - 1] = '\0';
     res->body = data;
     res->body_length = len;
+    res->cacheable = 1;
 }
 
 static int extract_bearer_token(const http_request_t *req, char *out, size_t out_len) {
-    const char *auth = http_header_get(req, "Authorization");
+    const char *auth = http_request_header(req, HTTP_HDR_AUTHORIZATION);
     if (!auth) return -1;
     while (*auth == ' ') auth++;
     if (strncasecmp(auth, "Bearer", 6) == 0) {
@@ -504,15 +497,6 @@ static void json_write_message(json_writer_t *jw, const message_record_t *msg) {
     jw_append(jw, "}");
 }
 
-static void json_write_message_list(json_writer_t *jw, const message_list_t *list) {
-    jw_append(jw, "[");
-    for (size_t i = 0; i < list->count; ++i) {
-        if (i > 0) jw_append_char(jw, ',');
-        json_write_message(jw, &list->items[i]);
-    }
-    jw_append(jw, "]");
-}
-
 static void json_write_attachment_list(json_writer_t *jw, const attachment_list_t *list) {
     jw_append(jw, "[");
     for (size_t i = 0; i < list->count; ++i) {
@@ -695,19 +679,20 @@ static int is_valid_password(const char *password) {
 }
 
 static void handle_register(ServerRuntime *rt, http_request_t *req, http_response_t *res) {
-    if (!req->body) {
+    const char *payload = http_request_body(req);
+    if (!payload) {
         respond_with_error(res, 400, "bad_request", "Missing request body");
         return;
     }
     jsmntok_t *tokens = NULL;
     int tok_count = 0;
-    if (json_parse(req->body, &tokens, &tok_count) != 0) {
+    if (json_parse(payload, &tokens, &tok_count) != 0) {
         respond_with_error(res, 400, "bad_json", "Invalid JSON payload");
         return;
     }
-    int user_idx = json_find_field(req->body, tokens, tok_count, "username");
-    int email_idx = json_find_field(req->body, tokens, tok_count, "email");
-    int pass_idx = json_find_field(req->body, tokens, tok_count, "password");
+    int user_idx = json_find_field(payload, tokens, tok_count, "username");
+    int email_idx = json_find_field(payload, tokens, tok_count, "email");
+    int pass_idx = json_find_field(payload, tokens, tok_count, "password");
     if (user_idx < 0 || email_idx < 0 || pass_idx < 0) {
         free(tokens);
         respond_with_error(res, 400, "bad_request", "username, email, and password required");
@@ -716,9 +701,9 @@ static void handle_register(ServerRuntime *rt, http_request_t *req, http_respons
     char username[USERNAME_MAX];
     char email[EMAIL_MAX];
     char password[PASSWORD_HASH_MAX];
-    if (json_copy_string(req->body, &tokens[user_idx], username, sizeof(username)) != 0 ||
-        json_copy_string(req->body, &tokens[email_idx], email, sizeof(email)) != 0 ||
-        json_copy_string(req->body, &tokens[pass_idx], password, sizeof(password)) != 0) {
+    if (json_copy_string(payload, &tokens[user_idx], username, sizeof(username)) != 0 ||
+        json_copy_string(payload, &tokens[email_idx], email, sizeof(email)) != 0 ||
+        json_copy_string(payload, &tokens[pass_idx], password, sizeof(password)) != 0) {
         free(tokens);
         respond_with_error(res, 400, "bad_request", "Invalid credential fields");
         return;
@@ -769,18 +754,19 @@ static void handle_register(ServerRuntime *rt, http_request_t *req, http_respons
 }
 
 static void handle_login(ServerRuntime *rt, http_request_t *req, http_response_t *res) {
-    if (!req->body) {
+    const char *payload = http_request_body(req);
+    if (!payload) {
         respond_with_error(res, 400, "bad_request", "Missing request body");
         return;
     }
     jsmntok_t *tokens = NULL;
     int tok_count = 0;
-    if (json_parse(req->body, &tokens, &tok_count) != 0) {
+    if (json_parse(payload, &tokens, &tok_count) != 0) {
         respond_with_error(res, 400, "bad_json", "Invalid JSON payload");
         return;
     }
-    int user_idx = json_find_field(req->body, tokens, tok_count, "username");
-    int pass_idx = json_find_field(req->body, tokens, tok_count, "password");
+    int user_idx = json_find_field(payload, tokens, tok_count, "username");
+    int pass_idx = json_find_field(payload, tokens, tok_count, "password");
     if (user_idx < 0 || pass_idx < 0) {
         free(tokens);
         respond_with_error(res, 400, "bad_request", "username and password required");
@@ -788,8 +774,8 @@ static void handle_login(ServerRuntime *rt, http_request_t *req, http_response_t
     }
     char username[USERNAME_MAX];
     char password[PASSWORD_HASH_MAX];
-    if (json_copy_string(req->body, &tokens[user_idx], username, sizeof(username)) != 0 ||
-        json_copy_string(req->body, &tokens[pass_idx], password, sizeof(password)) != 0) {
+    if (json_copy_string(payload, &tokens[user_idx], username, sizeof(username)) != 0 ||
+        json_copy_string(payload, &tokens[pass_idx], password, sizeof(password)) != 0) {
         free(tokens);
         respond_with_error(res, 400, "bad_request", "Invalid credential fields");
         return;
@@ -856,6 +842,27 @@ static void handle_mailboxes(ServerRuntime *rt, http_request_t *req, http_respon
     folder_list_free(&folders);
 }
 
+// Serializes the list a message at a time into the response stream, so a
+// large folder starts going out before the last message is written and is
+// never held as one JSON document.
+static void respond_with_message_list(http_response_t *res, const message_list_t *list) {
+    http_response_use_headers(res, HTTP_HEADERS_JSON);
+    json_writer_t jw{};
+    jw_append(&jw, "{\"messages\":[");
+    for (size_t i = 0; i < list->count; ++i) {
+        if (i > 0) jw_append_char(&jw, ',');
+        json_write_message(&jw, &list->items[i]);
+        if (http_response_stream_write(res, jw.buf, jw.len) != 0) {
+            std::free(jw.buf);
+            return;
+        }
+        jw.len = 0;
+    }
+    jw_append(&jw, "]}");
+    http_response_stream_write(res, jw.buf, jw.len);
+    std::free(jw.buf);
+}
+
 static void handle_messages_list(ServerRuntime *rt, http_request_t *req, http_response_t *res, const char *query) {
     user_record_t user{};
     char token[128];
@@ -883,11 +890,7 @@ static void handle_messages_list(ServerRuntime *rt, http_request_t *req, http_re
         respond_with_error(res, 500, "db_error", "Failed to load messages");
         return;
     }
-    json_writer_t jw{};
-    jw_append(&jw, "{\"messages\":");
-    json_write_message_list(&jw, &list);
-    jw_append_char(&jw, '}');
-    respond_with_json_writer(res, 200, "OK", &jw);
+    respond_with_message_list(res, &list);
     message_list_free(&list);
 }
 
@@ -928,13 +931,14 @@ static void handle_message_compose(ServerRuntime *rt, http_request_t *req, http_
     if (ensure_authenticated(rt, req, res, &user, token, sizeof(token)) != 0) {
         return;
     }
-    if (!req->body) {
+    const char *payload = http_request_body(req);
+    if (!payload) {
         respond_with_error(res, 400, "bad_request", "Missing request body");
         return;
     }
     jsmntok_t *tokens = NULL;
     int tok_count = 0;
-    if (json_parse(req->body, &tokens, &tok_count) != 0) {
+    if (json_parse(payload, &tokens, &tok_count) != 0) {
         respond_with_error(res, 400, "bad_json", "Invalid JSON");
         return;
     }
@@ -951,42 +955,42 @@ static void handle_message_compose(ServerRuntime *rt, http_request_t *req, http_
     uint64_t draft_id = 0;
     json_writer_t jw{};
 
-    int subject_idx = json_find_field(req->body, tokens, tok_count, "subject");
+    int subject_idx = json_find_field(payload, tokens, tok_count, "subject");
     if (subject_idx >= 0 && tokens[subject_idx].type == JSMN_STRING) {
-        json_copy_string(req->body, &tokens[subject_idx], subject, sizeof(subject));
+        json_copy_string(payload, &tokens[subject_idx], subject, sizeof(subject));
     }
-    int body_idx = json_find_field(req->body, tokens, tok_count, "body");
+    int body_idx = json_find_field(payload, tokens, tok_count, "body");
     if (body_idx >= 0 && tokens[body_idx].type == JSMN_STRING) {
-        json_copy_string(req->body, &tokens[body_idx], body, sizeof(body));
+        json_copy_string(payload, &tokens[body_idx], body, sizeof(body));
     }
-    int rcpt_idx = json_find_field(req->body, tokens, tok_count, "recipients");
+    int rcpt_idx = json_find_field(payload, tokens, tok_count, "recipients");
     if (rcpt_idx >= 0 && tokens[rcpt_idx].type == JSMN_STRING) {
-        json_copy_string(req->body, &tokens[rcpt_idx], recipients, sizeof(recipients));
+        json_copy_string(payload, &tokens[rcpt_idx], recipients, sizeof(recipients));
     }
-    int draft_idx = json_find_field(req->body, tokens, tok_count, "saveAsDraft");
+    int draft_idx = json_find_field(payload, tokens, tok_count, "saveAsDraft");
     if (draft_idx >= 0) {
-        json_get_bool(req->body, &tokens[draft_idx], &save_draft);
+        json_get_bool(payload, &tokens[draft_idx], &save_draft);
     }
-    int starred_idx = json_find_field(req->body, tokens, tok_count, "starred");
+    int starred_idx = json_find_field(payload, tokens, tok_count, "starred");
     if (starred_idx >= 0) {
-        json_get_bool(req->body, &tokens[starred_idx], &is_starred);
+        json_get_bool(payload, &tokens[starred_idx], &is_starred);
     }
-    int archived_idx = json_find_field(req->body, tokens, tok_count, "archived");
+    int archived_idx = json_find_field(payload, tokens, tok_count, "archived");
     if (archived_idx >= 0) {
-        json_get_bool(req->body, &tokens[archived_idx], &is_archived);
+        json_get_bool(payload, &tokens[archived_idx], &is_archived);
     }
-    int custom_idx = json_find_field(req->body, tokens, tok_count, "customFolder");
+    int custom_idx = json_find_field(payload, tokens, tok_count, "customFolder");
     if (custom_idx >= 0 && tokens[custom_idx].type == JSMN_STRING) {
-        json_copy_string(req->body, &tokens[custom_idx], custom, sizeof(custom));
+        json_copy_string(payload, &tokens[custom_idx], custom, sizeof(custom));
     }
-    int group_idx = json_find_field(req->body, tokens, tok_count, "archiveGroup");
+    int group_idx = json_find_field(payload, tokens, tok_count, "archiveGroup");
     if (group_idx >= 0 && tokens[group_idx].type == JSMN_STRING) {
-        json_copy_string(req->body, &tokens[group_idx], archive_group, sizeof(archive_group));
+        json_copy_string(payload, &tokens[group_idx], archive_group, sizeof(archive_group));
     }
 
     attachment_payload_t *payloads = NULL;
     size_t payload_count = 0;
-    int attachments_idx = json_find_field(req->body, tokens, tok_count, "attachments");
+    int attachments_idx = json_find_field(payload, tokens, tok_count, "attachments");
     if (attachments_idx >= 0 && tokens[attachments_idx].type == JSMN_ARRAY) {
         payload_count = (size_t)tokens[attachments_idx].size;
         if (payload_count > 0) {
@@ -1020,22 +1024,22 @@ static void handle_message_compose(ServerRuntime *rt, http_request_t *req, http_
                         respond_with_error(res, 400, "bad_request", "Invalid attachment key");
                         goto compose_cleanup;
                     }
-                    if (json_token_equals(req->body, &tokens[key_index], "filename")) {
-                        if (copy_string_checked(req->body, &tokens[val_index], pl->filename, sizeof(pl->filename)) != 0) {
+                    if (json_token_equals(payload, &tokens[key_index], "filename")) {
+                        if (copy_string_checked(payload, &tokens[val_index], pl->filename, sizeof(pl->filename)) != 0) {
                             respond_with_error(res, 400, "bad_request", "Filename too long");
                             goto compose_cleanup;
                         }
-                    } else if (json_token_equals(req->body, &tokens[key_index], "mimeType")) {
-                        if (copy_string_checked(req->body, &tokens[val_index], pl->mime_type, sizeof(pl->mime_type)) != 0) {
+                    } else if (json_token_equals(payload, &tokens[key_index], "mimeType")) {
+                        if (copy_string_checked(payload, &tokens[val_index], pl->mime_type, sizeof(pl->mime_type)) != 0) {
                             respond_with_error(res, 400, "bad_request", "Mime type too long");
                             goto compose_cleanup;
                         }
-                    } else if (json_token_equals(req->body, &tokens[key_index], "relativePath")) {
-                        if (copy_string_checked(req->body, &tokens[val_index], pl->relative_path, sizeof(pl->relative_path)) != 0) {
+                    } else if (json_token_equals(payload, &tokens[key_index], "relativePath")) {
+                        if (copy_string_checked(payload, &tokens[val_index], pl->relative_path, sizeof(pl->relative_path)) != 0) {
                             respond_with_error(res, 400, "bad_request", "Attachment path too long");
                             goto compose_cleanup;
                         }
-                    } else if (json_token_equals(req->body, &tokens[key_index], "data")) {
+                    } else if (json_token_equals(payload, &tokens[key_index], "data")) {
                         if (tokens[val_index].type != JSMN_STRING) {
                             respond_with_error(res, 400, "bad_request", "Attachment data must be string");
                             goto compose_cleanup;
@@ -1050,7 +1054,7 @@ static void handle_message_compose(ServerRuntime *rt, http_request_t *req, http_
                             respond_with_error(res, 500, "oom", "Out of memory");
                             goto compose_cleanup;
                         }
-                        memcpy(data, req->body + tokens[val_index].start, (size_t)len);
+                        memcpy(data, payload + tokens[val_index].start, (size_t)len);
                         data[len] = '\0';
                         if (pl->base64_data) free(pl->base64_data);
                         pl->base64_data = data;
@@ -1100,19 +1104,20 @@ static void handle_message_star(ServerRuntime *rt, http_request_t *req, http_res
     if (ensure_authenticated(rt, req, res, &user, token, sizeof(token)) != 0) {
         return;
     }
-    if (!req->body) {
+    const char *payload = http_request_body(req);
+    if (!payload) {
         respond_with_error(res, 400, "bad_request", "Missing request body");
         return;
     }
     jsmntok_t *tokens = NULL;
     int tok_count = 0;
-    if (json_parse(req->body, &tokens, &tok_count) != 0) {
+    if (json_parse(payload, &tokens, &tok_count) != 0) {
         respond_with_error(res, 400, "bad_json", "Invalid JSON");
         return;
     }
-    int starred_idx = json_find_field(req->body, tokens, tok_count, "starred");
+    int starred_idx = json_find_field(payload, tokens, tok_count, "starred");
     int starred = 0;
-    if (starred_idx < 0 || json_get_bool(req->body, &tokens[starred_idx], &starred) != 0) {
+    if (starred_idx < 0 || json_get_bool(payload, &tokens[starred_idx], &starred) != 0) {
         free(tokens);
         respond_with_error(res, 400, "bad_request", "Missing starred flag");
         return;
@@ -1136,27 +1141,28 @@ static void handle_message_archive(ServerRuntime *rt, http_request_t *req, http_
     if (ensure_authenticated(rt, req, res, &user, token, sizeof(token)) != 0) {
         return;
     }
-    if (!req->body) {
+    const char *payload = http_request_body(req);
+    if (!payload) {
         respond_with_error(res, 400, "bad_request", "Missing request body");
         return;
     }
     jsmntok_t *tokens = NULL;
     int tok_count = 0;
-    if (json_parse(req->body, &tokens, &tok_count) != 0) {
+    if (json_parse(payload, &tokens, &tok_count) != 0) {
         respond_with_error(res, 400, "bad_json", "Invalid JSON");
         return;
     }
-    int archived_idx = json_find_field(req->body, tokens, tok_count, "archived");
+    int archived_idx = json_find_field(payload, tokens, tok_count, "archived");
     int archived = 0;
-    if (archived_idx < 0 || json_get_bool(req->body, &tokens[archived_idx], &archived) != 0) {
+    if (archived_idx < 0 || json_get_bool(payload, &tokens[archived_idx], &archived) != 0) {
         free(tokens);
         respond_with_error(res, 400, "bad_request", "Missing archived flag");
         return;
     }
     char group_name[GROUP_NAME_MAX] = "";
-    int group_idx = json_find_field(req->body, tokens, tok_count, "archiveGroup");
+    int group_idx = json_find_field(payload, tokens, tok_count, "archiveGroup");
     if (group_idx >= 0 && tokens[group_idx].type == JSMN_STRING) {
-        json_copy_string(req->body, &tokens[group_idx], group_name, sizeof(group_name));
+        json_copy_string(payload, &tokens[group_idx], group_name, sizeof(group_name));
     }
     const char *group_ptr = archived ? (group_name[0] ? group_name : "") : "";
     if (mail_service_archive(rt->mail, user.id, message_id, archived, group_ptr) != 0) {
@@ -1180,30 +1186,31 @@ static void handle_create_folder(ServerRuntime *rt, http_request_t *req, http_re
     if (ensure_authenticated(rt, req, res, &user, token, sizeof(token)) != 0) {
         return;
     }
-    if (!req->body) {
+    const char *payload = http_request_body(req);
+    if (!payload) {
         respond_with_error(res, 400, "bad_request", "Missing request body");
         return;
     }
     jsmntok_t *tokens = NULL;
     int tok_count = 0;
-    if (json_parse(req->body, &tokens, &tok_count) != 0) {
+    if (json_parse(payload, &tokens, &tok_count) != 0) {
         respond_with_error(res, 400, "bad_json", "Invalid JSON");
         return;
     }
-    int name_idx = json_find_field(req->body, tokens, tok_count, "name");
+    int name_idx = json_find_field(payload, tokens, tok_count, "name");
     if (name_idx < 0 || tokens[name_idx].type != JSMN_STRING) {
         free(tokens);
         respond_with_error(res, 400, "bad_request", "Folder name required");
         return;
     }
     char name[GROUP_NAME_MAX];
-    json_copy_string(req->body, &tokens[name_idx], name, sizeof(name));
+    json_copy_string(payload, &tokens[name_idx], name, sizeof(name));
 
     folder_kind_t kind = FOLDER_CUSTOM;
-    int kind_idx = json_find_field(req->body, tokens, tok_count, "kind");
+    int kind_idx = json_find_field(payload, tokens, tok_count, "kind");
     if (kind_idx >= 0 && tokens[kind_idx].type == JSMN_STRING) {
         char kind_buf[32];
-        json_copy_string(req->body, &tokens[kind_idx], kind_buf, sizeof(kind_buf));
+        json_copy_string(payload, &tokens[kind_idx], kind_buf, sizeof(kind_buf));
         if (folder_kind_from_string(kind_buf, &kind) != 0) {
             free(tokens);
             respond_with_error(res, 400, "bad_request", "Unknown folder kind");
@@ -1250,43 +1257,44 @@ static void handle_contacts_add(ServerRuntime *rt, http_request_t *req, http_res
     if (ensure_authenticated(rt, req, res, &user, token, sizeof(token)) != 0) {
         return;
     }
-    if (!req->body) {
+    const char *payload = http_request_body(req);
+    if (!payload) {
         respond_with_error(res, 400, "bad_request", "Missing request body");
         return;
     }
     jsmntok_t *tokens = NULL;
     int tok_count = 0;
-    if (json_parse(req->body, &tokens, &tok_count) != 0) {
+    if (json_parse(payload, &tokens, &tok_count) != 0) {
         respond_with_error(res, 400, "bad_json", "Invalid JSON");
         return;
     }
     char alias_buf[USERNAME_MAX] = "";
     char group_buf[GROUP_NAME_MAX] = "";
-    int alias_idx = json_find_field(req->body, tokens, tok_count, "alias");
+    int alias_idx = json_find_field(payload, tokens, tok_count, "alias");
     if (alias_idx >= 0 && tokens[alias_idx].type == JSMN_STRING) {
-        json_copy_string(req->body, &tokens[alias_idx], alias_buf, sizeof(alias_buf));
+        json_copy_string(payload, &tokens[alias_idx], alias_buf, sizeof(alias_buf));
     }
-    int group_idx = json_find_field(req->body, tokens, tok_count, "groupName");
+    int group_idx = json_find_field(payload, tokens, tok_count, "groupName");
     if (group_idx >= 0 && tokens[group_idx].type == JSMN_STRING) {
-        json_copy_string(req->body, &tokens[group_idx], group_buf, sizeof(group_buf));
+        json_copy_string(payload, &tokens[group_idx], group_buf, sizeof(group_buf));
     }
     uint64_t contact_id = 0;
-    int id_idx = json_find_field(req->body, tokens, tok_count, "contactUserId");
+    int id_idx = json_find_field(payload, tokens, tok_count, "contactUserId");
     if (id_idx >= 0) {
         long long tmp;
-        if (json_get_long(req->body, &tokens[id_idx], &tmp) == 0 && tmp > 0) {
+        if (json_get_long(payload, &tokens[id_idx], &tmp) == 0 && tmp > 0) {
             contact_id = (uint64_t)tmp;
         }
     }
     if (contact_id == 0) {
-        int username_idx = json_find_field(req->body, tokens, tok_count, "username");
+        int username_idx = json_find_field(payload, tokens, tok_count, "username");
         if (username_idx < 0 || tokens[username_idx].type != JSMN_STRING) {
             free(tokens);
             respond_with_error(res, 400, "bad_request", "username or contactUserId required");
             return;
         }
         char username[USERNAME_MAX];
-        json_copy_string(req->body, &tokens[username_idx], username, sizeof(username));
+        json_copy_string(payload, &tokens[username_idx], username, sizeof(username));
     user_record_t contact_user{};
         if (db_get_user_by_username(rt->db, username, &contact_user) != 0) {
             free(tokens);
@@ -1444,6 +1452,102 @@ static void handle_api(ServerRuntime *rt, http_request_t *req, http_response_t *
     respond_with_error(res, 404, "not_found", "Unknown API endpoint");
 }
 
+// API routes that accept a body: 1 when they need a session, 0 when not, -1
+// when the route is not one of them and the full router decides.
+static int body_route_auth(http_method_t method, const char *path) {
+    if (method != HTTP_POST) {
+        return -1;
+    }
+    if (strcmp(path, "/api/register") == 0 || strcmp(path, "/api/login") == 0 ||
+        strcmp(path, "/api/logout") == 0) {
+        return 0;
+    }
+    if (strcmp(path, "/api/messages") == 0 || strcmp(path, "/api/folders") == 0 ||
+        strcmp(path, "/api/contacts") == 0) {
+        return 1;
+    }
+    if (strncmp(path, "/api/messages/", 14) == 0) {
+        const char *action = strrchr(path, '/');
+        if (strcmp(action, "/star") == 0 || strcmp(action, "/archive") == 0) {
+            return 1;
+        }
+    }
+    return -1;
+}
+
+int router_precheck(ServerRuntime *rt, const http_request_t *req, http_response_t *res) {
+    http_response_init(res);
+    const char *expect = http_request_header(req, HTTP_HDR_EXPECT);
+    if (expect && strcasecmp(expect, "100-continue") != 0) {
+        respond_with_error(res, 417, "expectation_failed", "Only 100-continue is supported");
+        return -1;
+    }
+
+    char path[ROUTER_PATH_MAX];
+    const char *query = NULL;
+    split_path_query(req->path, path, sizeof(path), &query);
+
+    if (strncmp(path, "/api/", 5) != 0) {
+        // Outside the API only GET, HEAD and OPTIONS are ever answered.
+        if (req->method == HTTP_POST || req->method == HTTP_PUT || req->method == HTTP_DELETE) {
+            respond_with_error(res, 404, "not_found", "Resource not found");
+            return -1;
+        }
+        return 0;
+    }
+    if (body_route_auth(req->method, path) == 1) {
+        // Read-only: validation and session renewal stay with the worker,
+        // once the request has actually been accepted.
+        char token[128];
+        std::uint64_t user_id = 0;
+        if (extract_bearer_token(req, token, sizeof(token)) != 0 ||
+            auth_service_session_user(rt->auth, token, &user_id) != 0) {
+            respond_unauthorized(res);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// RFC 9218 urgency ("u=0" most urgent .. "u=7"), 3 when absent.
+static int priority_urgency(const http_request_t *req) {
+    const char *value = http_header_get(req, "Priority");
+    if (!value) {
+        return 3;
+    }
+    for (const char *p = value; *p; ++p) {
+        if (p[0] == 'u' && p[1] == '=' && p[2] >= '0' && p[2] <= '7' &&
+            (p == value || p[-1] == ',' || p[-1] == ' ' || p[-1] == '\t')) {
+            return p[2] - '0';
+        }
+    }
+    return 3;
+}
+
+tp_class_t router_classify(const http_request_t *req) {
+    // Composing decodes attachments, writes them out and inserts a row per
+    // recipient; a spooled body is a large upload whatever the route.
+    if (req->body.fd >= 0) {
+        return TP_CLASS_BULK;
+    }
+    if (req->method == HTTP_POST && strncmp(req->path, "/api/messages", 13) == 0 &&
+        (req->path[13] == '\0' || req->path[13] == '?')) {
+        return TP_CLASS_BULK;
+    }
+    if (priority_urgency(req) >= 5) {
+        return TP_CLASS_BACKGROUND;
+    }
+    return TP_CLASS_INTERACTIVE;
+}
+
+int router_session_user(ServerRuntime *rt, const http_request_t *req, std::uint64_t *user_id) {
+    char token[128];
+    if (extract_bearer_token(req, token, sizeof(token)) != 0) {
+        return -1;
+    }
+    return auth_service_session_user(rt->auth, token, user_id);
+}
+
 void router_init(ServerRuntime *rt) {
     (void)rt;
 }
@@ -1451,21 +1555,23 @@ void router_init(ServerRuntime *rt) {
 void router_dispose() {}
 
 int router_handle_request(ServerRuntime *rt, http_request_t *req, RouterResult *out) {
-    http_response_init(&out->response);
-    const char *conn = http_header_get(req, "Connection");
+    http_response_t *res = out->response;
+    http_response_init(res);
+    res->stream = out->stream;
+    const char *conn = http_request_header(req, HTTP_HDR_CONNECTION);
     if (conn && strcasecmp(conn, "close") == 0) {
-        out->response.keep_alive = 0;
+        res->keep_alive = 0;
     }
 
     if (req->method == HTTP_OPTIONS) {
-        set_common_headers(&out->response);
-        out->response.status_code = 204;
-        strncpy(out->response.status_text, "No Content", sizeof(out->response.status_text) - 1);
-        out->response.status_text[sizeof(out->response.status_text) - 1] = '\0';
+        http_response_use_headers(res, HTTP_HEADERS_COMMON);
+        res->status_code = 204;
+        strncpy(res->status_text, "No Content", sizeof(res->status_text) - 1);
+        res->status_text[sizeof(res->status_text) - 1] = '\0';
         return 0;
     }
 
-    char path[sizeof(req->path)];
+    char path[ROUTER_PATH_MAX];
     const char *query = NULL;
     split_path_query(req->path, path, sizeof(path), &query);
 
@@ -1473,33 +1579,33 @@ int router_handle_request(ServerRuntime *rt, http_request_t *req, RouterResult *
     const http_method_t effective_method = is_head ? HTTP_GET : req->method;
 
     if (effective_method == HTTP_GET && strncmp(path, "/static/", 8) == 0) {
-        respond_with_static(rt, &out->response, path + 8);
+        respond_with_static(rt, res, path + 8);
         goto finalize;
     }
     if (effective_method == HTTP_GET && (strcmp(path, "/") == 0 || strcmp(path, "/index.html") == 0)) {
-        respond_with_static(rt, &out->response, "learn.html");
+        respond_with_static(rt, res, "learn.html");
         goto finalize;
     }
     if (effective_method == HTTP_GET && strcmp(path, "/learn.html") == 0) {
-        respond_with_static(rt, &out->response, "learn.html");
+        respond_with_static(rt, res, "learn.html");
         goto finalize;
     }
     if (effective_method == HTTP_GET && (strcmp(path, "/mail") == 0 || strcmp(path, "/mail/") == 0)) {
         template_var_t vars[] = {
             {"title", "MailCenter 登录"}
         };
-        respond_with_template(rt, &out->response, "login.html", vars, sizeof(vars)/sizeof(vars[0]));
+        respond_with_template(rt, res, "login.html", vars, sizeof(vars)/sizeof(vars[0]));
         goto finalize;
     }
     if (effective_method == HTTP_GET && (strcmp(path, "/mail/app") == 0 || strcmp(path, "/mail/app/") == 0 || strcmp(path, "/app") == 0)) {
         template_var_t vars[] = {
             {"title", "收件箱"}
         };
-        respond_with_template(rt, &out->response, "app.html", vars, sizeof(vars)/sizeof(vars[0]));
+        respond_with_template(rt, res, "app.html", vars, sizeof(vars)/sizeof(vars[0]));
         goto finalize;
     }
     if (strncmp(path, "/api/", 5) == 0) {
-        handle_api(rt, req, &out->response, path, query);
+        handle_api(rt, req, res, path, query);
         goto finalize;
     }
 
@@ -1507,20 +1613,19 @@ int router_handle_request(ServerRuntime *rt, http_request_t *req, RouterResult *
         const char *rel = path;
         while (*rel == '/') rel++;
         if (*rel == '\0') {
-            respond_with_static(rt, &out->response, "learn.html");
+            respond_with_static(rt, res, "learn.html");
         } else {
-            respond_with_static(rt, &out->response, rel);
+            respond_with_static(rt, res, rel);
         }
         goto finalize;
     }
 
-    respond_with_error(&out->response, 404, "not_found", "Resource not found");
+    respond_with_error(res, 404, "not_found", "Resource not found");
 
 finalize:
-    if (is_head && out->response.body) {
-        free(out->response.body);
-        out->response.body = NULL;
-    }
+    // A HEAD answer keeps its body here: the worker negotiates and compresses
+    // it exactly like GET and drops it only then, so both carry the same
+    // Content-Length, Content-Encoding and Vary.
     return 0;
 }
 
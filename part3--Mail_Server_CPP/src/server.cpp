@@ -5,110 +5,44 @@
 #include "connection.h"
 #include "router.h"
 #include "jobs.h"
+#include "reactor.h"
+#include "compress.h"
 
+#include <algorithm>
+#include <climits>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <errno.h>
 #include <memory>
+#include <thread>
 #include <vector>
 #include <unistd.h>
 #include <stdint.h>
+#include <strings.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <netinet/tcp.h>
 
 #define MAX_EVENTS 128
-
-namespace mail {
-
-struct ConnectionDeleter {
-    void operator()(connection_t *conn) const noexcept {
-        if (conn) {
-            connection_free(conn);
-            delete conn;
-        }
-    }
-};
-
-using ConnectionHandle = std::unique_ptr<connection_t, ConnectionDeleter>;
-
-class ConnectionTable {
-public:
-    explicit ConnectionTable(std::size_t initial_capacity)
-        : slots_(initial_capacity), count_(0) {}
-
-    connection_t *get(int fd) noexcept {
-        if (fd < 0) return nullptr;
-        const auto idx = static_cast<std::size_t>(fd);
-        if (idx >= slots_.size()) return nullptr;
-        return slots_[idx].get();
-    }
-
-    void insert(ConnectionHandle conn) {
-        const auto fd = static_cast<std::size_t>(conn->fd);
-        ensure_capacity(fd + 1);
-        if (!slots_[fd]) {
-            ++count_;
-        }
-        slots_[fd] = std::move(conn);
-    }
-
-    void erase(int fd) noexcept {
-        if (fd < 0) return;
-        const auto idx = static_cast<std::size_t>(fd);
-        if (idx >= slots_.size()) return;
-        if (slots_[idx]) {
-            slots_[idx].reset();
-            if (count_ > 0) {
-                --count_;
-            }
-        }
-    }
-
-    std::size_t size() const noexcept { return count_; }
-
-    void clear() noexcept {
-        for (auto &slot : slots_) {
-            slot.reset();
-        }
-        count_ = 0;
-    }
-
-private:
-    void ensure_capacity(std::size_t desired) {
-        if (desired <= slots_.size()) {
-            return;
-        }
-        std::size_t new_cap = slots_.empty() ? 1024 : slots_.size();
-        while (new_cap < desired) {
-            new_cap *= 2;
-        }
-        slots_.resize(new_cap);
-    }
-
-    std::vector<ConnectionHandle> slots_;
-    std::size_t count_;
-};
-
-inline ConnectionHandle make_connection(int fd) {
-    auto conn = ConnectionHandle{new connection_t{}, ConnectionDeleter{}};
-    connection_init(conn.get(), fd);
-    return conn;
-}
-
-} // namespace mail
+#define RESPONSE_BATCH 64
 
 namespace mail {
 namespace {
 
-int setup_listen_socket(const ServerConfig &cfg) {
+int setup_listen_socket(const ServerConfig &cfg, bool reuse_port) {
     int fd = socket(AF_INET, SOCK_STREAM, 0);
     if (fd < 0) return -1;
 
     int opt = 1;
     setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        close(fd);
+        return -1;
+    }
     setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
 
     struct sockaddr_in addr;
@@ -130,81 +64,570 @@ int setup_listen_socket(const ServerConfig &cfg) {
     return fd;
 }
 
-void notify_main(ServerRuntime *rt) {
+void notify_reactor(Reactor *r) {
     uint64_t one = 1;
-    ssize_t written = write(rt->event_fd, &one, sizeof(one));
+    ssize_t written = write(r->event_fd, &one, sizeof(one));
     (void)written;
 }
 
-void handle_worker_response(ServerRuntime *rt, ConnectionTable &table) {
-    uint64_t val;
-    while (read(rt->event_fd, &val, sizeof(val)) > 0) {}
+void post_response(Reactor *r, worker_response_t *resp) {
+    if (mpsc_ring_push(&r->response_ring, resp) != 0) {
+        mpsc_queue_push(&r->response_queue, resp);
+    }
+    // Pairs with the fence in reactor_prepare_wait: either the reactor sees
+    // this response before it sleeps, or we see it armed and wake it.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->wake_armed, __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&r->wake_armed, 0, __ATOMIC_ACQ_REL)) {
+        notify_reactor(r);
+    }
+}
 
-    while (auto *raw = static_cast<worker_response_t *>(cq_pop(&rt->response_queue))) {
-        std::unique_ptr<worker_response_t> resp(raw);
-        connection_t *conn = table.get(resp->fd);
-        if (!conn) {
-            continue;
+// Sends a response from the worker thread, header block and body in one
+// gathered write; the caller holds the connection's write gate. Whatever does
+// not fit into the socket buffer is left in resp as wire bytes for the
+// reactor. Returns false when the connection was closed meanwhile (the fd has
+// then been closed here).
+bool write_directly(worker_task_t *task, worker_response_t *resp) {
+    const int fd = CONN_ID_FD(task->conn_id);
+    http_response_t *res = &resp->response;
+    byte_buffer_t head;
+    if (buffer_init(&head, 1024) == 0) {
+        connection_serialize_head(&head, res);
+        const std::size_t body_len = res->body ? res->body_length : 0;
+        std::size_t sent = 0;
+        const std::size_t total = buffer_readable(&head) + body_len;
+        while (sent < total) {
+            struct iovec iov[2];
+            std::size_t count = 0;
+            if (sent < buffer_readable(&head)) {
+                iov[count].iov_base = head.data + sent;
+                iov[count].iov_len = buffer_readable(&head) - sent;
+                ++count;
+            }
+            std::size_t body_off = sent > buffer_readable(&head) ? sent - buffer_readable(&head) : 0;
+            if (body_len > body_off) {
+                iov[count].iov_base = res->body + body_off;
+                iov[count].iov_len = body_len - body_off;
+                ++count;
+            }
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = count;
+            ssize_t n = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n > 0) {
+                sent += static_cast<std::size_t>(n);
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else {
+                break; // EAGAIN or an error the reactor will see on its own write
+            }
         }
-        connection_prepare_response(conn, &resp->response);
-        struct epoll_event ev{};
-        ev.events = EPOLLOUT | EPOLLET;
-        ev.data.fd = conn->fd;
-        epoll_ctl(rt->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
-        conn->state = CONN_STATE_WRITING;
-        heap_remove_fd(&rt->connection_heap, conn->fd);
-        heap_push(&rt->connection_heap, heap_node_t{ .key_fd = conn->fd, .priority = -conn->last_activity_ms });
+        const std::size_t head_len = buffer_readable(&head);
+        if (sent == total) {
+            resp->sent = true;
+            buffer_free(&head);
+        } else {
+            resp->wire = true;
+            if (sent < head_len) {
+                memmove(head.data, head.data + sent, head_len - sent);
+                resp->wire_head = head.data;
+                resp->wire_head_len = head_len - sent;
+            } else {
+                buffer_free(&head);
+                resp->body_sent = sent - head_len;
+            }
+        }
+    }
+    if (!conn_token_release_writes(task->token)) {
+        close(fd);
+        return false;
+    }
+    return true;
+}
+
+// The worker's end of a streamed response: every flush becomes one part
+// posted to the reactor, throttled to the connection's stream window. With a
+// negotiated coding each part is compressed here before it is posted.
+struct WorkerStream {
+    http_stream_t base; // first, the router only sees this
+    worker_task_t *task;
+    std::uint32_t parts;
+    content_coding_t coding;
+    compress_stream_t *encoder;
+    bool unthrottled; // a window wait timed out; the rest goes out unpaced
+
+    ~WorkerStream() { compress_stream_end(encoder); }
+};
+
+std::uint32_t stream_waiter_limit(const ServerConfig &cfg) {
+    if (cfg.stream_max_waiting > 0) {
+        return cfg.stream_max_waiting;
+    }
+    return static_cast<std::uint32_t>(std::max<std::size_t>(cfg.thread_pool_size / 2, 1));
+}
+
+// Waits until the client has taken enough of the stream for the next part.
+// The wait holds a pool worker, so it is bounded in time and in how many
+// workers may be waiting at once. Returns 0 when there is room, 1 when the
+// part goes out without waiting (no waiting slot free), 2 when the wait timed
+// out and -1 once the connection is gone.
+int stream_wait(worker_task_t *task) {
+    ServerRuntime *rt = task->runtime;
+    const ServerConfig &cfg = rt->config;
+    int rc = conn_token_stream_wait(task->token, task->seq, cfg.stream_window_bytes, 0);
+    if (rc <= 0) {
+        return rc;
+    }
+    if (rt->stream_waiters.fetch_add(1, std::memory_order_relaxed) >= stream_waiter_limit(cfg)) {
+        rt->stream_waiters.fetch_sub(1, std::memory_order_relaxed);
+        return 1;
     }
+    // Waiting on a slow reader is not worker time, and must not count against
+    // the tenant's limit: an earlier request of the same connection, which
+    // this wait may depend on, could be parked behind that limit.
+    const std::uint64_t wait_start = util_now_ns();
+    tenant_leave(task->tenant);
+    reactor_capacity_freed(rt);
+    rc = conn_token_stream_wait(task->token, task->seq, cfg.stream_window_bytes, cfg.stream_wait_ms);
+    tenant_rejoin(task->tenant);
+    task->paused_ns += util_now_ns() - wait_start;
+    rt->stream_waiters.fetch_sub(1, std::memory_order_relaxed);
+    return rc > 0 ? 2 : rc;
 }
 
+int worker_stream_flush(http_stream_t *stream, http_response_t *res) {
+    auto *ws = reinterpret_cast<WorkerStream *>(stream);
+    worker_task_t *task = ws->task;
+    if (ws->parts == 0) {
+        ws->encoder = compress_stream_begin(task->runtime->compression, res, ws->coding);
+    }
+    if (ws->encoder && compress_stream_chunk(ws->encoder, res, 0) != 0) {
+        return -1;
+    }
+    // A reader too slow to drain the window in stream_wait_ms gets the rest
+    // of the body queued as a whole, as it would without streaming; the
+    // worker is what must not be held.
+    if (!ws->unthrottled) {
+        const int rc = stream_wait(task);
+        if (rc < 0) {
+            return -1;
+        }
+        ws->unthrottled = rc == 2;
+    }
+    auto part = std::make_unique<worker_response_t>();
+    part->conn_id = task->conn_id;
+    part->seq = task->seq;
+    part->part = ws->parts++;
+    part->more = true;
+    http_response_t *out = &part->response;
+    if (part->part == 0) {
+        // The head travels with the first part; the rest carry body only.
+        *out = *res;
+        out->stream = nullptr;
+        res->extra_headers = nullptr;
+        res->extra_headers_len = 0;
+    } else {
+        out->chunked = 1;
+        out->keep_alive = res->keep_alive;
+        out->body = res->body;
+        out->body_length = res->body_length;
+    }
+    res->body = nullptr;
+    res->body_length = 0;
+    res->body_capacity = 0;
+    conn_token_stream_posted(task->token, out->body_length);
+    post_response(task->reactor, part.release());
+    return 0;
+}
+
+// Runs last in worker_entry, once the task has given its tenant slot back.
+struct CapacityFreed {
+    ServerRuntime *runtime;
+    ~CapacityFreed() { reactor_capacity_freed(runtime); }
+};
+
 void worker_entry(void *arg) {
+    // The job just left the pool queue, which may let a parked request in.
+    CapacityFreed freed{static_cast<worker_task_t *>(arg)->runtime};
+    reactor_capacity_freed(freed.runtime);
     std::unique_ptr<worker_task_t> task(static_cast<worker_task_t *>(arg));
+    task->started_ns = util_now_ns(); // charged to its tenant when the task goes
+    if (conn_token_cancelled(task->token)) {
+        return; // the client is gone; skip the DB and serialization work
+    }
     ServerRuntime *rt = task->runtime;
-    RouterResult out;
-    http_response_init(&out.response);
+    auto resp = std::make_unique<worker_response_t>();
+    RouterResult out{&resp->response};
 
-    router_handle_request(rt, &task->request, &out);
+    // Chunked framing needs HTTP/1.1, and HEAD answers carry no body.
+    const content_coding_t coding = compress_negotiate(task->request);
+    WorkerStream stream{{worker_stream_flush, rt->config.stream_chunk_bytes}, task.get(), 0, coding, nullptr, false};
+    if (task->request->method != HTTP_HEAD && strcmp(task->request->version, "HTTP/1.1") == 0) {
+        out.stream = &stream.base;
+    }
+    router_handle_request(rt, task->request, &out);
+    resp->response.stream = nullptr;
+    if (conn_token_cancelled(task->token)) {
+        return; // closed while we ran; no wake-up
+    }
 
-    auto resp = std::make_unique<worker_response_t>();
-    resp->fd = task->fd;
-    resp->response = out.response;
-    out.response.body = NULL;
+    resp->conn_id = task->conn_id;
+    resp->seq = task->seq;
+    if (stream.parts > 0) {
+        // The last part of a streamed response: the remaining body and the
+        // terminating chunk.
+        resp->part = stream.parts;
+        resp->response.chunked = 1;
+        if (stream.encoder && compress_stream_chunk(stream.encoder, &resp->response, 1) != 0) {
+            // Cannot finish the encoded body: end it here and drop the
+            // connection so the client sees it truncated.
+            free(resp->response.body);
+            resp->response.body = nullptr;
+            resp->response.body_length = 0;
+            resp->response.keep_alive = 0;
+        }
+        conn_token_stream_posted(task->token, resp->response.body_length);
+        post_response(task->reactor, resp.release());
+        return;
+    }
+    compress_response(rt->compression, &resp->response, coding);
+    if (task->request->method == HTTP_HEAD) {
+        // Same head as the GET would get, Content-Length included.
+        free(resp->response.body);
+        resp->response.body = nullptr;
+    }
 
-    cq_push(&rt->response_queue, resp.release());
-    notify_main(rt);
+    // Close-after responses keep going through the reactor, which owns the
+    // connection's shutdown.
+    if (rt->config.direct_writes && resp->response.keep_alive &&
+        conn_token_claim_writes(task->token, task->seq)) {
+        if (!write_directly(task.get(), resp.get())) {
+            return;
+        }
+    }
+
+    post_response(task->reactor, resp.release());
 }
 
-bool dispatch_to_pool(ServerRuntime *rt, std::unique_ptr<worker_task_t> task) {
+// Never blocks the event loop: fails when the pool queue is full.
+bool submit_task(ServerRuntime *rt, worker_task_t *task) {
     tp_job_t job = {
         .fn = worker_entry,
-        .arg = task.get()
+        .arg = task,
+        .cls = task->cls
     };
-    if (thread_pool_submit(rt->pool, job) != 0) {
-        LOGE("thread pool full");
+    return thread_pool_try_submit(rt->pool, job) == 0;
+}
+
+std::uint32_t tenant_limit(const ServerConfig &cfg) {
+    if (cfg.tenant_max_inflight > 0) {
+        return cfg.tenant_max_inflight;
+    }
+    return static_cast<std::uint32_t>(std::max<std::size_t>(cfg.thread_pool_size / 2, 1));
+}
+
+constexpr std::uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ULL;
+
+std::uint64_t fnv1a(std::uint64_t h, const void *data, std::size_t n) {
+    const auto *p = static_cast<const unsigned char *>(data);
+    for (std::size_t i = 0; i < n; ++i) {
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// Requests are accounted to the session's user where there is one, so a
+// user's connections share one budget; the two key spaces differ in the
+// low bit. The session table is shared by every reactor behind one lock, so
+// a connection looks its Authorization value up once and reuses the answer
+// while the value stays the same; the worker still validates every request.
+std::uint64_t tenant_key(Reactor *r, connection_t *conn, const http_request_t *req) {
+    const std::uint64_t by_peer = conn->peer_key << 1 | 1;
+    if (r->runtime->config.tenant_key != TenantKey::User) {
+        return by_peer;
+    }
+    const char *auth = http_request_header(req, HTTP_HDR_AUTHORIZATION);
+    if (!auth) {
+        return by_peer;
+    }
+    const std::uint64_t hash = fnv1a(FNV_OFFSET_BASIS, auth, strlen(auth)) | 1; // never 0
+    if (hash != conn->auth_hash) {
+        std::uint64_t user_id;
+        conn->auth_tenant = router_session_user(r->runtime, req, &user_id) == 0 ? user_id << 1 : by_peer;
+        conn->auth_hash = hash;
+    }
+    return conn->auth_tenant;
+}
+
+// Hands a task to the pool, or parks it in its class's fair queue. Classes
+// are judged on their own queue, so a backlog of uploads neither delays nor
+// sheds logins; within a class a tenant at its limit waits without holding
+// up anyone else. Returns false when the request should be shed instead.
+bool admit_task(Reactor *r, std::unique_ptr<worker_task_t> task) {
+    const ServerConfig &cfg = r->runtime->config;
+    const tp_class_t cls = task->cls;
+    Tenant *tenant = task->tenant;
+    if (cfg.latency_budget_ms > 0 &&
+        thread_pool_wait_estimate_us(r->runtime->pool, cls, r->overflow[cls].size()) >
+            static_cast<std::uint64_t>(cfg.latency_budget_ms) * 1000) {
+        return false;
+    }
+    if (r->overflow[cls].empty() && tenant_enter(tenant, tenant_limit(cfg))) {
+        if (submit_task(r->runtime, task.get())) {
+            task.release();
+            return true;
+        }
+        tenant_leave(tenant);
+    }
+    if (r->overflow_count >= cfg.overflow_limit ||
+        __atomic_load_n(&tenant->waiting, __ATOMIC_RELAXED) >= cfg.tenant_queue_limit) {
+        return false;
+    }
+    r->overflow[cls].push(task.release());
+    r->overflow_count++;
+    return true;
+}
+
+FairSubmit drain_submit(void *ctx, worker_task_t *task) {
+    auto *r = static_cast<Reactor *>(ctx);
+    if (conn_token_cancelled(task->token)) {
+        return FairSubmit::Dropped; // its connection closed while it waited
+    }
+    return submit_task(r->runtime, task) ? FairSubmit::Sent : FairSubmit::Full;
+}
+
+std::string build_overload_response(const ServerConfig &cfg) {
+    static const char body[] = "{\"error\":\"overloaded\"}";
+    char head[256];
+    int len = snprintf(head, sizeof(head),
+                       "HTTP/1.1 503 Service Unavailable\r\n"
+                       "Retry-After: %u\r\n"
+                       "Content-Type: application/json; charset=utf-8\r\n"
+                       "Content-Length: %zu\r\n"
+                       "Connection: keep-alive\r\n\r\n",
+                       cfg.retry_after_s, sizeof(body) - 1);
+    std::string out(head, static_cast<std::size_t>(len));
+    out.append(body, sizeof(body) - 1);
+    return out;
+}
+
+void queue_overload_response(Reactor *r, connection_t *conn, std::uint32_t seq) {
+    auto resp = std::make_unique<worker_response_t>();
+    resp->conn_id = conn->id;
+    resp->seq = seq;
+    resp->raw = r->runtime->overload_response.data();
+    resp->raw_len = r->runtime->overload_response.size();
+    conn->reorder[seq % CONN_PIPELINE_MAX] = resp.release();
+}
+
+// Hash of the client's address without the port, so all connections from
+// one host share a tenant.
+std::uint64_t peer_key(int fd) {
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    if (getpeername(fd, reinterpret_cast<struct sockaddr *>(&addr), &len) != 0) {
+        return 0;
+    }
+    std::uint64_t h = FNV_OFFSET_BASIS;
+    if (addr.ss_family == AF_INET) {
+        const auto *in = reinterpret_cast<const struct sockaddr_in *>(&addr);
+        h = fnv1a(h, &in->sin_addr, sizeof(in->sin_addr));
+    } else if (addr.ss_family == AF_INET6) {
+        const auto *in6 = reinterpret_cast<const struct sockaddr_in6 *>(&addr);
+        h = fnv1a(h, &in6->sin6_addr, sizeof(in6->sin6_addr));
+    }
+    return h;
+}
+
+std::uint32_t pipeline_limit(const Reactor *r) {
+    return std::clamp<std::uint32_t>(r->runtime->config.pipeline_depth, 1, CONN_PIPELINE_MAX);
+}
+
+// A client that pipelines without reading its responses would otherwise make
+// the reactor stage them without bound.
+bool output_backlogged(const Reactor *r, const connection_t *conn) {
+    return out_queue_pending(&conn->out) > r->runtime->config.max_output_bytes;
+}
+
+// Queues a reactor-generated response at its place in the pipeline.
+void queue_local_response(connection_t *conn, std::uint32_t seq, int status, const char *status_text,
+                          const char *body, int keep_alive) {
+    auto resp = std::make_unique<worker_response_t>();
+    resp->conn_id = conn->id;
+    resp->seq = seq;
+    resp->response.status_code = status;
+    util_strlcpy(resp->response.status_text, sizeof(resp->response.status_text), status_text);
+    resp->response.keep_alive = keep_alive;
+    http_response_use_headers(&resp->response, HTTP_HEADERS_JSON);
+    resp->response.body_length = strlen(body);
+    resp->response.body = static_cast<char*>(std::malloc(resp->response.body_length));
+    memcpy(resp->response.body, body, resp->response.body_length);
+    conn->reorder[seq % CONN_PIPELINE_MAX] = resp.release();
+}
+
+// Runs the router's header checks on a request whose body is still to come.
+// A refused request is answered in order and ends the connection, since its
+// body will never be read; an accepted one that asked for it gets a
+// 100 Continue once every earlier response is out.
+bool precheck_request(Reactor *r, connection_t *conn) {
+    http_request_t *req = conn->parser.request;
+    http_response_t res;
+    if (router_precheck(r->runtime, req, &res) != 0) {
+        const std::uint32_t seq = conn->next_seq++;
+        auto resp = std::make_unique<worker_response_t>();
+        resp->conn_id = conn->id;
+        resp->seq = seq;
+        resp->response = res;
+        resp->response.keep_alive = 0;
+        conn->reorder[seq % CONN_PIPELINE_MAX] = resp.release();
+        http_parser_reset(&conn->parser);
+        conn->input_closed = 1;
+        if (conn->state == CONN_STATE_READING) {
+            conn->state = CONN_STATE_PROCESSING;
+        }
         return false;
     }
-    task.release();
+    const char *expect = http_request_header(req, HTTP_HDR_EXPECT);
+    conn->continue_pending = expect != nullptr;
     return true;
 }
 
-void process_request(ServerRuntime *rt, connection_t *conn) {
+void process_request(Reactor *r, connection_t *conn) {
     auto task = std::make_unique<worker_task_t>();
-    task->runtime = rt;
-    task->fd = conn->fd;
-    task->request = conn->parser.request;
-    conn->parser.request.body = NULL; // transferred
-    http_parser_reset(&conn->parser);
-    conn->state = CONN_STATE_PROCESSING;
-    if (!dispatch_to_pool(rt, std::move(task))) {
-        conn->state = CONN_STATE_READING;
+    task->runtime = r->runtime;
+    task->reactor = r;
+    task->conn_id = conn->id;
+    task->token = conn_token_ref(conn->token);
+    task->seq = conn->next_seq++;
+    // Nothing after a Connection: close request would ever be answered.
+    const char *conn_hdr = http_request_header(conn->parser.request, HTTP_HDR_CONNECTION);
+    if (conn_hdr && strcasecmp(conn_hdr, "close") == 0) {
+        conn->input_closed = 1;
+    }
+    task->request = http_parser_take_request(&conn->parser);
+    task->cls = router_classify(task->request);
+    task->tenant = r->runtime->tenants->acquire(tenant_key(r, conn, task->request));
+    conn->continue_pending = 0; // the body came anyway
+    conn->request_start_ms = 0;
+    if (conn->state == CONN_STATE_READING) {
+        conn->state = CONN_STATE_PROCESSING;
+    }
+    const std::uint32_t seq = task->seq;
+    if (!admit_task(r, std::move(task))) {
+        queue_overload_response(r, conn, seq);
     }
 }
 
-void accept_new_connections(ServerRuntime *rt, ConnectionTable &table) {
+void ready_push(Reactor *r, connection_t *conn) {
+    if (conn->in_ready) return;
+    conn->in_ready = 1;
+    conn->ready_next = nullptr;
+    if (r->ready_tail) r->ready_tail->ready_next = conn;
+    else r->ready_head = conn;
+    r->ready_tail = conn;
+}
+
+connection_t *ready_pop(Reactor *r) {
+    connection_t *conn = r->ready_head;
+    if (!conn) return nullptr;
+    r->ready_head = conn->ready_next;
+    if (!r->ready_head) r->ready_tail = nullptr;
+    conn->ready_next = nullptr;
+    conn->in_ready = 0;
+    return conn;
+}
+
+// The list only ever holds a handful of connections, so a scan is fine for
+// the rare close of one that is still queued.
+void ready_remove(Reactor *r, connection_t *conn) {
+    connection_t *prev = nullptr;
+    for (connection_t *it = r->ready_head; it; prev = it, it = it->ready_next) {
+        if (it != conn) continue;
+        if (prev) prev->ready_next = it->ready_next;
+        else r->ready_head = it->ready_next;
+        if (r->ready_tail == it) r->ready_tail = prev;
+        break;
+    }
+    conn->ready_next = nullptr;
+    conn->in_ready = 0;
+}
+
+void close_connection(Reactor *r, ConnectionTable &table, int fd) {
+    if (connection_t *conn = table.get(fd)) {
+        if (conn->in_ready) ready_remove(r, conn);
+        reactor_forget(r, conn);
+    }
+    epoll_ctl(r->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    table.erase(fd);
+}
+
+// Input stays registered for the whole lifetime of a connection; EPOLLOUT is
+// added while the output queue holds bytes. Unchanged masks skip the syscall.
+void update_interest(Reactor *r, connection_t *conn) {
+    uint32_t events = EPOLLIN | EPOLLET;
+    if (out_queue_pending(&conn->out) > 0) {
+        events |= EPOLLOUT;
+    }
+    if (conn->registered_events == static_cast<int>(events)) {
+        return;
+    }
+    struct epoll_event ev{};
+    ev.events = events;
+    ev.data.fd = conn->fd;
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev) == 0) {
+        conn->registered_events = static_cast<int>(events);
+    }
+}
+
+// After responses arrive or output drains: stage what is next in order,
+// parse requests that were held back by a full pipeline or output backlog and
+// resume reading if that was throttled too.
+void pump_connection(Reactor *r, connection_t *conn) {
+    reactor_flush_responses(r, conn);
+    reactor_consume_input(r, conn);
+    reactor_flush_responses(r, conn);
+    if (conn->read_stalled && reactor_wants_input(r, conn)) {
+        conn->read_stalled = 0;
+        ready_push(r, conn);
+    }
+    update_interest(r, conn);
+    reactor_touch(r, conn);
+}
+
+// Applies worker responses in batches; each connection that received any is
+// then flushed, re-parsed and has its epoll interest updated once per batch.
+void handle_worker_responses(Reactor *r, ConnectionTable &table) {
+    worker_response_t *batch[RESPONSE_BATCH];
+    connection_t *touched[RESPONSE_BATCH];
+    std::size_t n;
+    while ((n = reactor_take_responses(r, batch, RESPONSE_BATCH)) > 0) {
+        std::size_t touched_count = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            std::unique_ptr<worker_response_t> resp(batch[i]);
+            connection_t *conn = reactor_apply_response(r, table, resp.get());
+            if (!conn) {
+                continue;
+            }
+            resp.release();
+            if (!conn->in_batch) {
+                conn->in_batch = 1;
+                touched[touched_count++] = conn;
+            }
+        }
+        for (std::size_t i = 0; i < touched_count; ++i) {
+            touched[i]->in_batch = 0;
+            pump_connection(r, touched[i]);
+        }
+    }
+}
+
+void accept_new_connections(Reactor *r, ConnectionTable &table) {
     while (true) {
         struct sockaddr_in addr;
         socklen_t len = sizeof(addr);
-        int client_fd = accept(rt->listen_fd, (struct sockaddr *)&addr, &len);
+        int client_fd = accept(r->listen_fd, (struct sockaddr *)&addr, &len);
         if (client_fd < 0) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) break;
             LOGE("accept error: %s", strerror(errno));
@@ -213,155 +636,614 @@ void accept_new_connections(ServerRuntime *rt, ConnectionTable &table) {
         util_set_nonblocking(client_fd);
         util_set_cloexec(client_fd);
 
-        auto conn_handle = make_connection(client_fd);
-        connection_t *conn = conn_handle.get();
-        table.insert(std::move(conn_handle));
-        heap_push(&rt->connection_heap, heap_node_t{ .key_fd = conn->fd, .priority = -conn->last_activity_ms });
-
-        if (table.size() > rt->config.max_connections) {
-            heap_node_t victim;
-            if (heap_pop(&rt->connection_heap, &victim) == 0) {
-                if (victim.key_fd != conn->fd) {
-                    connection_t *drop = table.get(victim.key_fd);
-                    if (drop) {
-                        epoll_ctl(rt->epoll_fd, EPOLL_CTL_DEL, victim.key_fd, NULL);
-                        table.erase(victim.key_fd);
-                    }
-                }
-            }
+        int victim = reactor_adopt_connection(r, table, client_fd);
+        if (victim >= 0) {
+            close_connection(r, table, victim);
         }
 
         struct epoll_event ev{};
         ev.events = EPOLLIN | EPOLLET;
         ev.data.fd = client_fd;
-        epoll_ctl(rt->epoll_fd, EPOLL_CTL_ADD, client_fd, &ev);
+        epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, client_fd, &ev);
+        if (connection_t *conn = table.get(client_fd)) {
+            conn->registered_events = static_cast<int>(ev.events);
+        }
     }
 }
 
-void handle_connection_event(ServerRuntime *rt, ConnectionTable &table, struct epoll_event *ev) {
+// Reads up to the configured budget and parses what arrived. A socket that
+// was not drained goes to the back of the ready-list; under EPOLLET no new
+// edge would arrive for the bytes it still holds. Returns -1 once closed.
+int read_connection(Reactor *r, ConnectionTable &table, connection_t *conn) {
+    if (!reactor_wants_input(r, conn)) {
+        conn->read_stalled = 1; // pump_connection resumes once a slot frees
+        return 0;
+    }
+    const ServerConfig &cfg = r->runtime->config;
+    size_t max_bytes = cfg.read_budget_bytes ? cfg.read_budget_bytes : SIZE_MAX;
+    unsigned max_reads = cfg.read_budget_reads ? cfg.read_budget_reads : UINT_MAX;
+    int rc = connection_handle_read(conn, max_bytes, max_reads);
+    if (rc < 0) {
+        close_connection(r, table, conn->fd);
+        return -1;
+    }
+    reactor_consume_input(r, conn);
+    reactor_flush_responses(r, conn);
+    update_interest(r, conn);
+    reactor_touch(r, conn);
+    if (rc > 0) {
+        if (reactor_wants_input(r, conn)) {
+            ready_push(r, conn);
+        } else {
+            conn->read_stalled = 1;
+        }
+    }
+    return 0;
+}
+
+// One budgeted read for every connection that was on the ready-list when the
+// turn started; those still not drained requeue behind them.
+void service_ready_list(Reactor *r, ConnectionTable &table) {
+    std::size_t pending = 0;
+    for (connection_t *it = r->ready_head; it; it = it->ready_next) {
+        ++pending;
+    }
+    while (pending-- > 0) {
+        connection_t *conn = ready_pop(r);
+        if (!conn) break;
+        read_connection(r, table, conn);
+    }
+}
+
+void handle_connection_event(Reactor *r, ConnectionTable &table, struct epoll_event *ev) {
     int fd = ev->data.fd;
     connection_t *conn = table.get(fd);
     if (!conn) {
-        epoll_ctl(rt->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+        epoll_ctl(r->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
         close(fd);
         return;
     }
 
     if (ev->events & (EPOLLHUP | EPOLLERR)) {
-        heap_remove_fd(&rt->connection_heap, fd);
-        epoll_ctl(rt->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
-        table.erase(fd);
+        close_connection(r, table, fd);
         return;
     }
 
-    if (conn->state == CONN_STATE_READING && (ev->events & EPOLLIN)) {
-        if (connection_handle_read(conn) < 0) {
-            heap_remove_fd(&rt->connection_heap, fd);
-            epoll_ctl(rt->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
-            table.erase(fd);
+    if (ev->events & EPOLLIN) {
+        if (read_connection(r, table, conn) < 0) {
             return;
         }
-        heap_remove_fd(&rt->connection_heap, fd);
-        heap_push(&rt->connection_heap, heap_node_t{ .key_fd = fd, .priority = -conn->last_activity_ms });
-        parse_result_t res;
-        do {
-            res = http_parser_execute(&conn->parser, &conn->read_buf);
-            if (res == PARSE_COMPLETE) {
-                process_request(rt, conn);
-                break;
-            }
-            if (res == PARSE_ERROR) {
-                http_response_reset(&conn->response);
-                conn->response.status_code = 400;
-                strcpy(conn->response.status_text, "Bad Request");
-                const char *body = "{""error"":""bad_request""}";
-                conn->response.body_length = strlen(body);
-                conn->response.body = static_cast<char*>(std::malloc(conn->response.body_length));
-                memcpy(conn->response.body, body, conn->response.body_length);
-                connection_prepare_response(conn, &conn->response);
-                struct epoll_event wev{};
-                wev.events = EPOLLOUT | EPOLLET;
-                wev.data.fd = fd;
-                epoll_ctl(rt->epoll_fd, EPOLL_CTL_MOD, fd, &wev);
-                break;
-            }
-        } while (res == PARSE_COMPLETE);
     }
 
     if (conn->state == CONN_STATE_WRITING && (ev->events & EPOLLOUT)) {
+        const bool was_backlogged = output_backlogged(r, conn);
         if (connection_handle_write(conn) < 0 || conn->state == CONN_STATE_CLOSING) {
-            heap_remove_fd(&rt->connection_heap, fd);
-            epoll_ctl(rt->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
-            table.erase(fd);
+            close_connection(r, table, fd);
             return;
         }
-        if (conn->state == CONN_STATE_READING) {
-            struct epoll_event rev{};
-            rev.events = EPOLLIN | EPOLLET;
-            rev.data.fd = fd;
-            epoll_ctl(rt->epoll_fd, EPOLL_CTL_MOD, fd, &rev);
+        if (conn->state == CONN_STATE_WRITING && !(was_backlogged && !output_backlogged(r, conn))) {
+            reactor_touch(r, conn); // partial write
+        } else {
+            pump_connection(r, conn);
         }
     }
 }
 
-} // namespace
-
-int server_run(ServerRuntime *rt) {
-    ConnectionTable table{1024};
-    rt->connections = &table;
-
-    rt->listen_fd = setup_listen_socket(rt->config);
-    if (rt->listen_fd < 0) {
+int reactor_setup(Reactor *r) {
+    ServerRuntime *rt = r->runtime;
+    r->listen_fd = setup_listen_socket(rt->config, rt->reactor_count > 1);
+    if (r->listen_fd < 0) {
         LOGF("failed to bind %s:%d", rt->config.listen_address.c_str(), rt->config.port);
         return -1;
     }
 
-    rt->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
-    if (rt->epoll_fd < 0) {
+    r->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    mpsc_queue_init(&r->response_queue);
+    if (r->event_fd < 0 ||
+        mpsc_ring_init(&r->response_ring, rt->config.response_ring_size) != 0) {
+        LOGF("failed to init response queue for reactor %zu", r->index);
+        if (r->event_fd >= 0) close(r->event_fd);
+        r->event_fd = -1;
+        return -1;
+    }
+
+    // Each reactor enforces its share of the global connection cap.
+    r->max_connections = (rt->config.max_connections + rt->reactor_count - 1) / rt->reactor_count;
+    timer_wheel_init(&r->timers, util_now_ms(), rt->config.timer_tick_ms);
+    buffer_pool_init(&r->buffers);
+    http_date_refresh(util_now_ms());
+
+    if (rt->config.io_engine == IoEngine::IoUring) {
+        if (uring_engine_setup(r) == 0) {
+            return 0;
+        }
+        LOGW("reactor %zu: io_uring unavailable, falling back to epoll", r->index);
+    }
+
+    r->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (r->epoll_fd < 0) {
         LOGF("epoll_create1 failed: %s", strerror(errno));
         return -1;
     }
 
     struct epoll_event ev{};
     ev.events = EPOLLIN;
-    ev.data.fd = rt->listen_fd;
-    epoll_ctl(rt->epoll_fd, EPOLL_CTL_ADD, rt->listen_fd, &ev);
+    ev.data.fd = r->listen_fd;
+    epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->listen_fd, &ev);
 
-    rt->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
     struct epoll_event eev{};
     eev.events = EPOLLIN;
-    eev.data.fd = rt->event_fd;
-    epoll_ctl(rt->epoll_fd, EPOLL_CTL_ADD, rt->event_fd, &eev);
-
-    heap_init(&rt->connection_heap, rt->config.max_connections);
+    eev.data.fd = r->event_fd;
+    epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->event_fd, &eev);
+    return 0;
+}
 
-    router_init(rt);
+void reactor_teardown(Reactor *r) {
+    for (FairQueue &queue : r->overflow) {
+        while (worker_task_t *task = queue.pop()) {
+            delete task;
+        }
+    }
+    r->overflow_count = 0;
+    if (r->connections) {
+        r->connections->clear();
+        r->connections = nullptr;
+    }
+    if (r->uring) {
+        uring_engine_teardown(r);
+    }
+    buffer_pool_destroy(&r->buffers);
+    if (r->event_fd >= 0) {
+        while (mpsc_node_t *node = mpsc_queue_pop(&r->response_queue)) {
+            worker_response_free(static_cast<worker_response_t *>(node));
+        }
+        mpsc_ring_destroy(&r->response_ring, worker_response_dispose);
+        close(r->event_fd);
+    }
+    if (r->epoll_fd >= 0) close(r->epoll_fd);
+    if (r->listen_fd >= 0) close(r->listen_fd);
+    r->listen_fd = r->epoll_fd = r->event_fd = -1;
+}
 
+void epoll_engine_run(Reactor *r, ConnectionTable &table) {
     struct epoll_event events[MAX_EVENTS];
 
-    LOGI("server listening on %s:%d", rt->config.listen_address.c_str(), rt->config.port);
-
     while (1) {
-        int n = epoll_wait(rt->epoll_fd, events, MAX_EVENTS, -1);
+        int timeout = r->ready_head ? 0 : reactor_next_timeout(r);
+        if (timeout != 0 && !reactor_prepare_wait(r)) {
+            timeout = 0;
+        }
+        int n = epoll_wait(r->epoll_fd, events, MAX_EVENTS, timeout);
+        reactor_end_wait(r);
         if (n < 0) {
             if (errno == EINTR) continue;
             break;
         }
+        reactor_expire_timers(r, table, close_connection);
+        reactor_drain_overflow(r);
         for (int i = 0; i < n; ++i) {
-            if (events[i].data.fd == rt->listen_fd) {
-                accept_new_connections(rt, table);
-            } else if (events[i].data.fd == rt->event_fd) {
-                handle_worker_response(rt, table);
+            if (events[i].data.fd == r->listen_fd) {
+                accept_new_connections(r, table);
+            } else if (events[i].data.fd == r->event_fd) {
+                uint64_t val;
+                while (read(r->event_fd, &val, sizeof(val)) > 0) {}
             } else {
-                handle_connection_event(rt, table, &events[i]);
+                handle_connection_event(r, table, &events[i]);
             }
         }
+        handle_worker_responses(r, table);
+        service_ready_list(r, table);
+    }
+}
+
+void reactor_loop(Reactor *r) {
+    ConnectionTable table{1024};
+    r->connections = &table;
+
+    if (r->uring) {
+        uring_engine_run(r, table);
+    } else {
+        epoll_engine_run(r, table);
     }
 
-    router_dispose();
     table.clear();
-    rt->connections = nullptr;
-    return 0;
+    r->connections = nullptr;
+}
+
+} // namespace
+
+int reactor_adopt_connection(Reactor *r, ConnectionTable &table, int client_fd) {
+    auto conn_handle = make_connection(client_fd, CONN_ID(client_fd, ++r->next_generation),
+                                       &r->buffers, &r->runtime->body_limits);
+    connection_t *conn = conn_handle.get();
+    conn->peer_key = peer_key(client_fd);
+    table.insert(std::move(conn_handle));
+    reactor_touch(r, conn);
+
+    if (table.size() > r->max_connections && r->lru_head && r->lru_head != conn) {
+        return r->lru_head->fd;
+    }
+    return -1;
+}
+
+void reactor_consume_input(Reactor *r, connection_t *conn) {
+    const std::uint32_t limit = pipeline_limit(r);
+    while (!conn->input_closed && conn->state != CONN_STATE_CLOSING &&
+           connection_inflight(conn) < limit && !output_backlogged(r, conn)) {
+        parse_result_t res = http_parser_execute(&conn->parser, &conn->read_buf);
+        if (res == PARSE_COMPLETE) {
+            process_request(r, conn);
+            continue;
+        }
+        if (res == PARSE_HEADERS) {
+            if (precheck_request(r, conn)) {
+                continue;
+            }
+            break;
+        }
+        if (res == PARSE_ERROR || res == PARSE_TOO_LARGE || res == PARSE_HEADER_TOO_LARGE) {
+            // The rest of the stream cannot be framed any more; an oversized
+            // body is refused before any of it is read.
+            conn->input_closed = 1;
+            if (res == PARSE_TOO_LARGE) {
+                queue_local_response(conn, conn->next_seq++, 413, "Payload Too Large",
+                                     "{\"error\":\"payload_too_large\"}", 0);
+            } else if (res == PARSE_HEADER_TOO_LARGE) {
+                queue_local_response(conn, conn->next_seq++, 431,
+                                     "Request Header Fields Too Large",
+                                     "{\"error\":\"headers_too_large\"}", 0);
+            } else {
+                queue_local_response(conn, conn->next_seq++, 400, "Bad Request",
+                                     "{\"error\":\"bad_request\"}", 0);
+            }
+            if (conn->state == CONN_STATE_READING) {
+                conn->state = CONN_STATE_PROCESSING;
+            }
+        }
+        break;
+    }
+    connection_release_buffers(conn);
+}
+
+connection_t *reactor_apply_response(Reactor *r, ConnectionTable &table, worker_response_t *resp) {
+    (void)r;
+    connection_t *conn = table.get(CONN_ID_FD(resp->conn_id));
+    if (!conn || conn->id != resp->conn_id || conn->state == CONN_STATE_CLOSING) {
+        return nullptr;
+    }
+    void *&slot = conn->reorder[resp->seq % CONN_PIPELINE_MAX];
+    if (resp->seq - conn->write_seq >= connection_inflight(conn)) {
+        return nullptr;
+    }
+    if (slot) {
+        // Another part of the same streamed response; keep them in part
+        // order, since the ring and the overflow queue may swap two.
+        auto **link = reinterpret_cast<worker_response_t **>(&slot);
+        while (*link && (*link)->part < resp->part) {
+            link = &(*link)->next_part;
+        }
+        if ((*link && (*link)->part == resp->part) || (!resp->part && !resp->more)) {
+            return nullptr;
+        }
+        resp->next_part = *link;
+        *link = resp;
+        return conn;
+    }
+    if (conn->writes_offered && resp->seq == conn->write_seq) {
+        // A worker that wrote directly has already handed the gate back; if
+        // this one did not, take the unclaimed gate back before staging.
+        if (!resp->sent && !resp->wire && !conn_token_reclaim_writes(conn->token)) {
+            return nullptr;
+        }
+        conn->writes_offered = 0;
+    }
+    slot = resp;
+    return conn;
+}
+
+namespace {
+
+// Opens the write gate for the next response when the reactor has no output
+// queued for the connection, so its worker may write it directly.
+void reactor_offer_writes(Reactor *r, connection_t *conn) {
+    if (!r->runtime->config.direct_writes || conn->writes_offered || conn->stream_part > 0 ||
+        conn->state == CONN_STATE_CLOSING || !conn->keep_alive ||
+        out_queue_pending(&conn->out) > 0 || connection_inflight(conn) == 0 ||
+        conn->reorder[conn->write_seq % CONN_PIPELINE_MAX]) {
+        return;
+    }
+    conn_token_open_writes(conn->token, conn->write_seq);
+    conn->writes_offered = 1;
+}
+
+} // namespace
+
+int reactor_flush_responses(Reactor *r, connection_t *conn) {
+    int staged = 0;
+    int written = 0;
+    if (conn->stream_unsent > 0 && out_queue_pending(&conn->out) == 0) {
+        // Everything staged so far is on the wire: give a streaming worker
+        // its window back.
+        conn_token_stream_written(conn->token, conn->stream_unsent);
+        conn->stream_unsent = 0;
+    }
+    while (conn->write_seq != conn->next_seq) {
+        void *&slot = conn->reorder[conn->write_seq % CONN_PIPELINE_MAX];
+        auto *head = static_cast<worker_response_t *>(slot);
+        if (!head || head->part != conn->stream_part) {
+            break; // not produced yet, or an earlier part is still on its way
+        }
+        std::unique_ptr<worker_response_t> resp(head);
+        slot = head->next_part;
+        resp->next_part = nullptr;
+        const bool streamed = resp->part > 0 || resp->more;
+        if (resp->more) {
+            conn->stream_part++; // the request stays at the head for its next part
+        } else {
+            conn->stream_part = 0;
+            conn->write_seq++;
+        }
+        if (!conn->keep_alive) {
+            continue; // the connection closes after an earlier response
+        }
+        if (streamed) {
+            conn->stream_unsent += resp->response.body_length;
+        }
+        if (resp->sent) {
+            conn->last_activity_ms = util_now_ms();
+            written = 1;
+            continue;
+        }
+        if (resp->raw) {
+            connection_append_raw(conn, nullptr, resp->raw, resp->raw_len);
+        } else if (resp->wire) {
+            http_response_t *res = &resp->response;
+            connection_append_raw(conn, resp->wire_head, resp->wire_head, resp->wire_head_len);
+            resp->wire_head = nullptr;
+            if (res->body && res->body_length > resp->body_sent) {
+                connection_append_raw(conn, res->body, res->body + resp->body_sent,
+                                      res->body_length - resp->body_sent);
+                res->body = nullptr;
+            }
+            conn->keep_alive = res->keep_alive;
+        } else if (resp->part > 0) {
+            connection_append_chunk(conn, &resp->response, !resp->more);
+        } else {
+            connection_prepare_response(conn, &resp->response);
+        }
+        if (!conn->keep_alive) {
+            conn->input_closed = 1;
+        }
+        staged = 1;
+    }
+    if (conn->continue_pending && conn->write_seq == conn->next_seq && conn->keep_alive) {
+        // Interim answer for the request being read; it has no sequence
+        // number yet, so it goes out once everything before it has.
+        static const char continue_line[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        connection_append_raw(conn, nullptr, continue_line, sizeof(continue_line) - 1);
+        conn->continue_pending = 0;
+        staged = 1;
+    }
+    conn_token_set_head(conn->token, conn->write_seq);
+    if (written && !staged && conn->state != CONN_STATE_CLOSING) {
+        conn->state = connection_inflight(conn) > 0 ? CONN_STATE_PROCESSING : CONN_STATE_READING;
+    }
+    if (staged || written) {
+        reactor_touch(r, conn);
+    }
+    reactor_offer_writes(r, conn);
+    return staged;
+}
+
+bool reactor_wants_input(Reactor *r, const connection_t *conn) {
+    const std::size_t read_limit = connection_read_limit(conn);
+    return conn->state != CONN_STATE_CLOSING && !conn->input_closed &&
+           connection_inflight(conn) < pipeline_limit(r) && !output_backlogged(r, conn) &&
+           (read_limit == 0 || buffer_readable(&conn->read_buf) < read_limit);
+}
+
+namespace {
+
+void lru_unlink(Reactor *r, connection_t *conn) {
+    if (conn->lru_prev) conn->lru_prev->lru_next = conn->lru_next;
+    else if (r->lru_head == conn) r->lru_head = conn->lru_next;
+    if (conn->lru_next) conn->lru_next->lru_prev = conn->lru_prev;
+    else if (r->lru_tail == conn) r->lru_tail = conn->lru_prev;
+    conn->lru_prev = conn->lru_next = nullptr;
+}
+
+} // namespace
+
+void reactor_touch(Reactor *r, connection_t *conn) {
+    lru_unlink(r, conn);
+    conn->lru_prev = r->lru_tail;
+    if (r->lru_tail) r->lru_tail->lru_next = conn;
+    else r->lru_head = conn;
+    r->lru_tail = conn;
+
+    const ServerConfig &cfg = r->runtime->config;
+    std::uint32_t timeout = 0;
+    long long since = conn->last_activity_ms;
+    switch (conn->state) {
+        case CONN_STATE_READING:
+            if (!conn->parser.headers_complete && buffer_readable(&conn->read_buf) > 0) {
+                // A header deadline does not move with each trickled byte.
+                if (conn->request_start_ms == 0) conn->request_start_ms = conn->last_activity_ms;
+                since = conn->request_start_ms;
+                timeout = cfg.header_timeout_ms;
+            } else {
+                if (!conn->parser.headers_complete) conn->request_start_ms = 0;
+                timeout = cfg.idle_timeout_ms;
+            }
+            break;
+        case CONN_STATE_WRITING:
+            timeout = cfg.write_timeout_ms;
+            break;
+        default:
+            break; // a worker owns the request; nothing to time out
+    }
+    if (timeout == 0) {
+        timer_wheel_cancel(&r->timers, &conn->timer);
+        return;
+    }
+    timer_wheel_schedule(&r->timers, &conn->timer, since + timeout);
+}
+
+void reactor_forget(Reactor *r, connection_t *conn) {
+    conn_token_cancel(conn->token);
+    lru_unlink(r, conn);
+    timer_wheel_cancel(&r->timers, &conn->timer);
+}
+
+namespace {
+
+struct ExpireContext {
+    Reactor *reactor;
+    ConnectionTable *table;
+    ReactorCloseFn close_fn;
+};
+
+void expire_connection(timer_node_t *node, void *arg) {
+    auto *ctx = static_cast<ExpireContext *>(arg);
+    auto *conn = static_cast<connection_t *>(node->data);
+    LOGD("closing fd %d after timeout (state %d)", conn->fd, static_cast<int>(conn->state));
+    ctx->close_fn(ctx->reactor, *ctx->table, conn->fd);
+}
+
+} // namespace
+
+void reactor_expire_timers(Reactor *r, ConnectionTable &table, ReactorCloseFn close_fn) {
+    ExpireContext ctx{r, &table, close_fn};
+    const long long now = util_now_ms();
+    http_date_refresh(now);
+    timer_wheel_advance(&r->timers, now, expire_connection, &ctx);
+}
+
+int reactor_next_timeout(Reactor *r) {
+    return timer_wheel_next_timeout(&r->timers, util_now_ms());
+}
+
+bool reactor_prepare_wait(Reactor *r) {
+    const bool parked = r->overflow_count > 0;
+    __atomic_store_n(&r->overflow_parked, parked ? 1 : 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&r->wake_armed, 1, __ATOMIC_RELAXED);
+    // Pairs with the fence in reactor_capacity_freed: either we see the new
+    // epoch and drain again, or the worker sees us armed and wakes us.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (mpsc_ring_empty(&r->response_ring) && mpsc_queue_empty(&r->response_queue) &&
+        (!parked || r->runtime->capacity_epoch.load(std::memory_order_relaxed) == r->overflow_epoch)) {
+        return true;
+    }
+    __atomic_store_n(&r->wake_armed, 0, __ATOMIC_RELAXED);
+    return false;
+}
+
+void reactor_end_wait(Reactor *r) {
+    __atomic_store_n(&r->wake_armed, 0, __ATOMIC_RELAXED);
+}
+
+std::size_t reactor_take_responses(Reactor *r, worker_response_t **out, std::size_t max) {
+    std::size_t n = mpsc_ring_pop_batch(&r->response_ring, reinterpret_cast<void **>(out), max);
+    if (n < max && !mpsc_queue_empty(&r->response_queue)) {
+        mpsc_node_t *nodes[64];
+        while (n < max) {
+            std::size_t want = std::min(max - n, sizeof(nodes) / sizeof(nodes[0]));
+            std::size_t got = mpsc_queue_pop_batch(&r->response_queue, nodes, want);
+            for (std::size_t i = 0; i < got; ++i) {
+                out[n++] = static_cast<worker_response_t *>(nodes[i]);
+            }
+            if (got < want) break;
+        }
+    }
+    return n;
+}
+
+// Most urgent class first. A class whose pool queue is still full keeps its
+// order and waits; the next class may still have room.
+void reactor_capacity_freed(ServerRuntime *rt) {
+    rt->capacity_epoch.fetch_add(1, std::memory_order_release);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (std::size_t i = 0; i < rt->reactor_count; ++i) {
+        Reactor *r = &rt->reactors[i];
+        if (__atomic_load_n(&r->overflow_parked, __ATOMIC_RELAXED) &&
+            __atomic_load_n(&r->wake_armed, __ATOMIC_RELAXED) &&
+            __atomic_exchange_n(&r->wake_armed, 0, __ATOMIC_ACQ_REL)) {
+            notify_reactor(r);
+        }
+    }
+}
+
+void reactor_drain_overflow(Reactor *r) {
+    // Read before trying, so capacity freed during the drain still counts
+    // as new in reactor_prepare_wait.
+    r->overflow_epoch = r->runtime->capacity_epoch.load(std::memory_order_acquire);
+    const ServerConfig &cfg = r->runtime->config;
+    const std::uint64_t quantum_ns = static_cast<std::uint64_t>(cfg.tenant_quantum_us) * 1000;
+    const std::uint32_t limit = tenant_limit(cfg);
+    std::size_t count = 0;
+    for (FairQueue &queue : r->overflow) {
+        if (!queue.empty()) {
+            queue.drain(quantum_ns, limit, drain_submit, r);
+        }
+        count += queue.size();
+    }
+    r->overflow_count = count;
+}
+
+int server_run(ServerRuntime *rt) {
+    std::size_t count = rt->config.reactor_count;
+    if (count == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        count = cpus > 0 ? static_cast<std::size_t>(cpus) : 1;
+    }
+
+    rt->overload_response = build_overload_response(rt->config);
+    rt->spool_dir = rt->config.spool_dir.string();
+    rt->body_limits.max_header = rt->config.max_header_bytes;
+    rt->body_limits.max_body = rt->config.max_body_bytes;
+    rt->body_limits.spool_threshold = rt->config.body_spool_threshold;
+    rt->body_limits.spool_dir = rt->spool_dir.c_str();
+
+    auto reactors = std::make_unique<Reactor[]>(count);
+    rt->reactors = reactors.get();
+    rt->reactor_count = count;
+
+    int rc = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        reactors[i].runtime = rt;
+        reactors[i].index = i;
+        if (reactor_setup(&reactors[i]) != 0) {
+            rc = -1;
+            break;
+        }
+    }
+
+    if (rc == 0) {
+        router_init(rt);
+
+        LOGI("server listening on %s:%d (%zu reactor%s)", rt->config.listen_address.c_str(),
+             rt->config.port, count, count == 1 ? "" : "s");
+
+        // Reactor 0 runs on the calling thread, the rest get their own.
+        std::vector<std::thread> threads;
+        threads.reserve(count - 1);
+        for (std::size_t i = 1; i < count; ++i) {
+            threads.emplace_back(reactor_loop, &reactors[i]);
+        }
+        reactor_loop(&reactors[0]);
+        for (auto &t : threads) {
+            t.join();
+        }
+
+        router_dispose();
+    }
+
+    for (std::size_t i = 0; i < count; ++i) {
+        reactor_teardown(&reactors[i]);
+    }
+    rt->reactors = nullptr;
+    rt->reactor_count = 0;
+    return rc;
 }
 
 } // namespace mail
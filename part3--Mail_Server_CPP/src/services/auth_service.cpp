@@ -145,6 +145,20 @@ int auth_service_validate(auth_context_t *ctx, const char *token, user_record_t
     }
     return 0;
 }
+
+int auth_service_session_user(auth_context_t *ctx, const char *token, uint64_t *user_id) {
+    if (!ctx || !token) return -1;
+    pthread_mutex_lock(&ctx->mutex);
+    session_record_t *session = find_session(ctx, token);
+    int rc = -1;
+    if (session && session->expires_at > time(NULL)) {
+        *user_id = session->user_id;
+        rc = 0;
+    }
+    pthread_mutex_unlock(&ctx->mutex);
+    return rc;
+}
+
 int auth_service_register(auth_context_t *ctx, const char *username, const char *email, const char *password,
                           char *token_out, size_t token_len, user_record_t *user_out) {
     if (!ctx || !username || !email || !password || !token_out) return -1;
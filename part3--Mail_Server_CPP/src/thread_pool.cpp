@@ -1,8 +1,34 @@
 #include "thread_pool.h"
+#include "job_ring.h"
 
+#include <climits>
 #include <cstdlib>
 #include <cstring>
 #include <errno.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// Work-stealing scheduler. Each worker owns a Chase-Lev deque: it pushes and
+// takes at the bottom without contention, idle workers steal from the top of
+// a randomly chosen victim. Jobs submitted from outside the pool (the
+// reactors) go to a shared injection queue per request class. From the
+// interactive queue a worker moves a small batch into its own deque at a
+// time, so that lock is taken once per batch rather than once per job; bulk
+// and background jobs are long enough to be taken one by one. With
+// TP_QUEUE_MPMC the injection queues are lock-free rings and no lock is taken
+// at all. Idle workers park on a futex.
+//
+// The first `reserved` workers only run interactive jobs. The others pick the
+// class to serve first from a weighted schedule and fall back to the rest in
+// priority order, so no worker idles while anything is queued.
+
+#define DEQUE_CAPACITY 256 // power of two
+#define DEQUE_MASK (DEQUE_CAPACITY - 1)
+#define INJECT_BATCH 16    // most jobs moved from the injection queue at once
+#define SCHEDULE_MAX 64
 
 typedef struct job_queue {
     tp_job_t *jobs;
@@ -12,17 +38,78 @@ typedef struct job_queue {
     size_t size;
 } job_queue_t;
 
+typedef struct lane {
+    pthread_mutex_t lock; // TP_QUEUE_MUTEX
+    job_queue_t inject;
+    size_t inject_size;   // mirrors inject.size for lock-free emptiness checks
+    job_ring_t ring;      // TP_QUEUE_MPMC
+    // Jobs of this class accepted and not yet started, wherever they sit.
+    size_t queued;
+    uint64_t avg_job_ns;  // EWMA (1/8) of the class's job run time
+} lane_t;
+
+// Idle workers sleep in two groups: reserved ones wait for interactive jobs
+// only, so a bulk job must wake a shared one.
+enum { GROUP_RESERVED, GROUP_SHARED, GROUP_COUNT };
+
+typedef struct worker {
+    // Stealers advance top, the owner moves bottom; kept on separate lines.
+    alignas(64) int64_t top;
+    alignas(64) int64_t bottom;
+    tp_job_t slots[DEQUE_CAPACITY]; // interactive jobs only
+    thread_pool_t *pool;
+    uint64_t rng; // xorshift state for picking steal victims
+    uint32_t tick; // position in the pool's class schedule
+    int reserved;
+    pthread_t thread;
+} worker_t;
+
 struct thread_pool {
-    pthread_t *threads;
+    worker_t *workers;
     size_t thread_count;
-    job_queue_t queue;
-    pthread_mutex_t mutex;
-    pthread_cond_t cond_jobs;
-    pthread_cond_t cond_empty;
+    size_t started;
+    size_t capacity; // per class
+    size_t reserved;
+    tp_queue_t queue;
+    lane_t lanes[TP_CLASS_COUNT];
+    // Which class a shared worker serves first, spread out by weight.
+    tp_class_t schedule[SCHEDULE_MAX];
+    size_t schedule_len;
+    // Jobs of any class accepted and not yet started. Submitters reserve a
+    // unit before publishing the job.
+    size_t queued;
+    uint32_t wake_seq[GROUP_COUNT]; // futex words idle workers sleep on
+    uint32_t sleepers[GROUP_COUNT];
+    uint32_t space_seq;  // futex word blocked submitters sleep on
+    uint32_t space_waiters;
     int shutting_down;
     tp_error_cb on_error;
 };
 
+static thread_local worker_t *tp_self;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void record_job_time(lane_t *lane, uint64_t ns) {
+    uint64_t avg = __atomic_load_n(&lane->avg_job_ns, __ATOMIC_RELAXED);
+    avg = avg == 0 ? ns : avg - avg / 8 + ns / 8;
+    __atomic_store_n(&lane->avg_job_ns, avg, __ATOMIC_RELAXED);
+}
+
+static void futex_wait(uint32_t *word, uint32_t expected) {
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+// Returns how many sleepers it woke.
+static long futex_wake(uint32_t *word, int count) {
+    __atomic_add_fetch(word, 1, __ATOMIC_RELEASE);
+    return syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
 static void job_queue_init(job_queue_t *q, size_t cap) {
     q->jobs = static_cast<tp_job_t*>(std::calloc(cap, sizeof(tp_job_t)));
     q->capacity = cap;
@@ -54,37 +141,291 @@ static int job_queue_pop(job_queue_t *q, tp_job_t *out) {
     return 0;
 }
 
-static void *worker_main(void *arg) {
-    thread_pool_t *pool = (thread_pool_t *)arg;
-    while (1) {
-        pthread_mutex_lock(&pool->mutex);
-        while (!pool->shutting_down && pool->queue.size == 0) {
-            pthread_cond_wait(&pool->cond_jobs, &pool->mutex);
+// Slots are read by stealers while the owner may be reusing them; a stealer
+// that read a stale slot loses its CAS on top, so relaxed atomics suffice.
+// Only interactive jobs ever sit in a deque, so the class is not stored.
+static void slot_store(tp_job_t *slot, tp_job_t job) {
+    __atomic_store_n(&slot->fn, job.fn, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->arg, job.arg, __ATOMIC_RELAXED);
+}
+
+static tp_job_t slot_load(tp_job_t *slot) {
+    tp_job_t job;
+    job.fn = __atomic_load_n(&slot->fn, __ATOMIC_RELAXED);
+    job.arg = __atomic_load_n(&slot->arg, __ATOMIC_RELAXED);
+    job.cls = TP_CLASS_INTERACTIVE;
+    return job;
+}
+
+// Owner only.
+static int deque_push(worker_t *w, tp_job_t job) {
+    int64_t b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED);
+    int64_t t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+    if (b - t >= DEQUE_CAPACITY) {
+        return -1;
+    }
+    slot_store(&w->slots[b & DEQUE_MASK], job);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+// Owner only: free slots, a lower bound since top only grows.
+static size_t deque_space(worker_t *w) {
+    int64_t b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED);
+    int64_t t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+    return (size_t)(DEQUE_CAPACITY - (b - t));
+}
+
+// Owner only: takes the most recently pushed job, racing stealers for the
+// last one.
+static int deque_take(worker_t *w, tp_job_t *out) {
+    int64_t b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&w->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t t = __atomic_load_n(&w->top, __ATOMIC_RELAXED);
+    if (t > b) {
+        __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    *out = slot_load(&w->slots[b & DEQUE_MASK]);
+    if (t == b) {
+        bool won = __atomic_compare_exchange_n(&w->top, &t, t + 1, false,
+                                               __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+        __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+        return won ? 0 : -1;
+    }
+    return 0;
+}
+
+// Any thread: takes the oldest job.
+static int deque_steal(worker_t *w, tp_job_t *out) {
+    int64_t t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t b = __atomic_load_n(&w->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) {
+        return -1;
+    }
+    tp_job_t job = slot_load(&w->slots[t & DEQUE_MASK]);
+    if (!__atomic_compare_exchange_n(&w->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return -1;
+    }
+    *out = job;
+    return 0;
+}
+
+// Takes one job from a class's injection queue. With a worker given, up to
+// a fair share of the rest moves into its deque too; they are pushed newest
+// first, so the owner still runs them oldest first.
+static int lane_take(thread_pool_t *pool, tp_class_t cls, worker_t *w, tp_job_t *out) {
+    lane_t *lane = &pool->lanes[cls];
+    tp_job_t batch[INJECT_BATCH];
+    size_t n = 0;
+    size_t share;
+    if (pool->queue == TP_QUEUE_MPMC) {
+        if (job_ring_pop(&lane->ring, out) != 0) {
+            return -1;
         }
+        if (w) {
+            share = job_ring_size(&lane->ring) / pool->thread_count;
+            size_t space = deque_space(w);
+            if (share > INJECT_BATCH) share = INJECT_BATCH;
+            if (share > space) share = space;
+            while (n < share && job_ring_pop(&lane->ring, &batch[n]) == 0) {
+                ++n;
+            }
+        }
+    } else {
+        if (__atomic_load_n(&lane->inject_size, __ATOMIC_ACQUIRE) == 0) {
+            return -1;
+        }
+        pthread_mutex_lock(&lane->lock);
+        if (job_queue_pop(&lane->inject, out) != 0) {
+            pthread_mutex_unlock(&lane->lock);
+            return -1;
+        }
+        if (w) {
+            share = lane->inject.size / pool->thread_count;
+            size_t space = deque_space(w);
+            if (share > INJECT_BATCH) share = INJECT_BATCH;
+            if (share > space) share = space;
+            while (n < share && job_queue_pop(&lane->inject, &batch[n]) == 0) {
+                ++n;
+            }
+        }
+        __atomic_store_n(&lane->inject_size, lane->inject.size, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&lane->lock);
+    }
+    while (n > 0) {
+        deque_push(w, batch[--n]);
+    }
+    return 0;
+}
 
-        if (pool->shutting_down && pool->queue.size == 0) {
-            pthread_mutex_unlock(&pool->mutex);
-            break;
+static uint64_t next_random(worker_t *w) {
+    uint64_t x = w->rng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    w->rng = x;
+    return x;
+}
+
+// Visits every other worker once, starting at a random one.
+static int steal_any(thread_pool_t *pool, worker_t *self, tp_job_t *out) {
+    size_t n = pool->thread_count;
+    size_t start = (size_t)(next_random(self) % n);
+    for (size_t i = 0; i < n; ++i) {
+        worker_t *victim = &pool->workers[(start + i) % n];
+        if (victim != self && deque_steal(victim, out) == 0) {
+            return 0;
         }
+    }
+    return -1;
+}
 
-    tp_job_t job{};
-        if (job_queue_pop(&pool->queue, &job) != 0) {
-            pthread_mutex_unlock(&pool->mutex);
-            continue;
+static int take_interactive(thread_pool_t *pool, worker_t *w, tp_job_t *out) {
+    return deque_take(w, out) == 0 || lane_take(pool, TP_CLASS_INTERACTIVE, w, out) == 0 ||
+           steal_any(pool, w, out) == 0 ? 0 : -1;
+}
+
+static int find_job(thread_pool_t *pool, worker_t *w, tp_job_t *out) {
+    if (w->reserved) {
+        return take_interactive(pool, w, out);
+    }
+    tp_class_t first = pool->schedule[w->tick++ % pool->schedule_len];
+    if (first != TP_CLASS_INTERACTIVE && lane_take(pool, first, NULL, out) == 0) {
+        return 0;
+    }
+    if (take_interactive(pool, w, out) == 0) {
+        return 0;
+    }
+    for (int c = TP_CLASS_BULK; c < TP_CLASS_COUNT; ++c) {
+        if (lane_take(pool, (tp_class_t)c, NULL, out) == 0) {
+            return 0;
         }
+    }
+    return -1;
+}
+
+// Jobs w could run that are accepted but not yet started.
+static size_t eligible_jobs(thread_pool_t *pool, const worker_t *w) {
+    return w->reserved ? __atomic_load_n(&pool->lanes[TP_CLASS_INTERACTIVE].queued, __ATOMIC_SEQ_CST)
+                       : __atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST);
+}
+
+// Every submission must wake a distinct sleeper: jobs of one connection can
+// wait on each other (write order, stream windows), so a job left behind a
+// busy worker while another sleeps may never run. A reserved sleeper counted
+// but already woken by an earlier submission does not count.
+static void wake_worker(thread_pool_t *pool, tp_class_t cls) {
+    if (cls == TP_CLASS_INTERACTIVE && __atomic_load_n(&pool->sleepers[GROUP_RESERVED], __ATOMIC_SEQ_CST) > 0 &&
+        futex_wake(&pool->wake_seq[GROUP_RESERVED], 1) > 0) {
+        return;
+    }
+    if (__atomic_load_n(&pool->sleepers[GROUP_SHARED], __ATOMIC_SEQ_CST) > 0) {
+        futex_wake(&pool->wake_seq[GROUP_SHARED], 1);
+    }
+}
+
+// A job left the queues to run: frees its unit of capacity. Blocked
+// submitters may wait on any class, so all of them re-check.
+static void release_slot(thread_pool_t *pool, tp_class_t cls) {
+    __atomic_sub_fetch(&pool->lanes[cls].queued, 1, __ATOMIC_SEQ_CST);
+    __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->space_waiters, __ATOMIC_SEQ_CST) > 0) {
+        futex_wake(&pool->space_seq, INT_MAX);
+    }
+}
 
-        if (pool->queue.size == 0) {
-            pthread_cond_signal(&pool->cond_empty);
+static void *worker_main(void *arg) {
+    worker_t *w = (worker_t *)arg;
+    thread_pool_t *pool = w->pool;
+    const int group = w->reserved ? GROUP_RESERVED : GROUP_SHARED;
+    tp_self = w;
+    while (1) {
+        tp_job_t job{};
+        if (find_job(pool, w, &job) == 0) {
+            release_slot(pool, job.cls);
+            if (job.fn) {
+                uint64_t start = monotonic_ns();
+                job.fn(job.arg);
+                record_job_time(&pool->lanes[job.cls], monotonic_ns() - start);
+            }
+            continue;
         }
-        pthread_mutex_unlock(&pool->mutex);
 
-        if (job.fn) {
-            job.fn(job.arg);
+        // Nothing found. A job is accepted (queued raised) before it is
+        // published, so a non-zero count means one is about to become
+        // visible or a steal lost a race: look again instead of sleeping.
+        if (eligible_jobs(pool, w) > 0) {
+            sched_yield();
+            continue;
+        }
+        if (__atomic_load_n(&pool->shutting_down, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        // Announce the sleep before the final check; a submitter raises the
+        // counts before it looks at sleepers, so one of the two sees the other.
+        uint32_t seq = __atomic_load_n(&pool->wake_seq[group], __ATOMIC_ACQUIRE);
+        __atomic_add_fetch(&pool->sleepers[group], 1, __ATOMIC_SEQ_CST);
+        if (eligible_jobs(pool, w) == 0 && !__atomic_load_n(&pool->shutting_down, __ATOMIC_ACQUIRE)) {
+            futex_wait(&pool->wake_seq[group], seq);
         }
+        __atomic_sub_fetch(&pool->sleepers[group], 1, __ATOMIC_SEQ_CST);
     }
+    tp_self = NULL;
     return NULL;
 }
 
+static void stop_workers(thread_pool_t *pool) {
+    __atomic_store_n(&pool->shutting_down, 1, __ATOMIC_SEQ_CST);
+    for (int g = 0; g < GROUP_COUNT; ++g) {
+        futex_wake(&pool->wake_seq[g], INT_MAX);
+    }
+    futex_wake(&pool->space_seq, INT_MAX);
+    for (size_t i = 0; i < pool->started; ++i) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    pool->started = 0;
+}
+
+// Smooth weighted round-robin over the classes, so a 6:3:1 split interleaves
+// instead of running in blocks. Weights are scaled down to SCHEDULE_MAX
+// entries; a class with a non-zero weight keeps at least one.
+static void build_schedule(thread_pool_t *pool, const unsigned *weights) {
+    unsigned w[TP_CLASS_COUNT];
+    unsigned total = 0;
+    for (int c = 0; c < TP_CLASS_COUNT; ++c) {
+        total += weights[c];
+    }
+    for (int c = 0; c < TP_CLASS_COUNT; ++c) {
+        if (total == 0) {
+            w[c] = 1;
+        } else if (total > SCHEDULE_MAX && weights[c] > 0) {
+            w[c] = weights[c] * (SCHEDULE_MAX - TP_CLASS_COUNT) / total;
+            if (w[c] == 0) w[c] = 1;
+        } else {
+            w[c] = weights[c];
+        }
+    }
+    total = 0;
+    for (int c = 0; c < TP_CLASS_COUNT; ++c) {
+        total += w[c];
+    }
+    int current[TP_CLASS_COUNT] = {0};
+    for (unsigned i = 0; i < total; ++i) {
+        int best = 0;
+        for (int c = 0; c < TP_CLASS_COUNT; ++c) {
+            current[c] += (int)w[c];
+            if (current[c] > current[best]) best = c;
+        }
+        current[best] -= (int)total;
+        pool->schedule[i] = (tp_class_t)best;
+    }
+    pool->schedule_len = total;
+}
+
 thread_pool_t *thread_pool_create(const thread_pool_config_t *cfg) {
     if (!cfg || cfg->thread_count == 0 || cfg->queue_capacity == 0) {
         errno = EINVAL;
@@ -97,27 +438,48 @@ thread_pool_t *thread_pool_create(const thread_pool_config_t *cfg) {
     }
 
     pool->thread_count = cfg->thread_count;
-    pool->threads = static_cast<pthread_t*>(std::calloc(pool->thread_count, sizeof(pthread_t)));
+    pool->capacity = cfg->queue_capacity;
     pool->on_error = cfg->on_error;
-    job_queue_init(&pool->queue, cfg->queue_capacity);
-
-    pthread_mutex_init(&pool->mutex, NULL);
-    pthread_cond_init(&pool->cond_jobs, NULL);
-    pthread_cond_init(&pool->cond_empty, NULL);
+    size_t workers_len = (pool->thread_count * sizeof(worker_t) + 63) & ~(size_t)63;
+    pool->workers = static_cast<worker_t*>(std::aligned_alloc(64, workers_len));
+    if (!pool->workers) {
+        std::free(pool);
+        return NULL;
+    }
+    memset(pool->workers, 0, workers_len);
+    pool->queue = cfg->queue;
+    pool->reserved = cfg->reserved < pool->thread_count ? cfg->reserved : pool->thread_count - 1;
+    build_schedule(pool, cfg->weights);
+    for (int c = 0; c < TP_CLASS_COUNT; ++c) {
+        lane_t *lane = &pool->lanes[c];
+        pthread_mutex_init(&lane->lock, NULL);
+        int rc = 0;
+        if (pool->queue == TP_QUEUE_MPMC) {
+            rc = job_ring_init(&lane->ring, cfg->queue_capacity);
+        } else {
+            job_queue_init(&lane->inject, cfg->queue_capacity);
+            rc = lane->inject.jobs ? 0 : -1;
+        }
+        if (rc != 0) {
+            thread_pool_destroy(pool);
+            return NULL;
+        }
+    }
 
     for (size_t i = 0; i < pool->thread_count; ++i) {
-        int rc = pthread_create(&pool->threads[i], NULL, worker_main, pool);
+        worker_t *w = &pool->workers[i];
+        w->pool = pool;
+        w->rng = 0x9e3779b97f4a7c15ULL * (i + 1);
+        w->tick = (uint32_t)i; // spread the shared workers over the schedule
+        w->reserved = i < pool->reserved;
+        int rc = pthread_create(&w->thread, NULL, worker_main, w);
         if (rc != 0) {
             if (pool->on_error) pool->on_error("pthread_create failed");
-            pool->shutting_down = 1;
-            pthread_cond_broadcast(&pool->cond_jobs);
-            for (size_t j = 0; j < i; ++j) {
-                pthread_join(pool->threads[j], NULL);
-            }
             thread_pool_destroy(pool);
             errno = rc;
             return NULL;
         }
+        pool->started++;
     }
 
     return pool;
@@ -126,51 +488,114 @@ thread_pool_t *thread_pool_create(const thread_pool_config_t *cfg) {
 void thread_pool_destroy(thread_pool_t *pool) {
     if (!pool) return;
 
-    pthread_mutex_lock(&pool->mutex);
-    pool->shutting_down = 1;
-    pthread_cond_broadcast(&pool->cond_jobs);
-    pthread_mutex_unlock(&pool->mutex);
+    // Workers drain every accepted job before they exit.
+    stop_workers(pool);
 
-    for (size_t i = 0; i < pool->thread_count; ++i) {
-        pthread_join(pool->threads[i], NULL);
+    for (int c = 0; c < TP_CLASS_COUNT; ++c) {
+        pthread_mutex_destroy(&pool->lanes[c].lock);
+        job_queue_destroy(&pool->lanes[c].inject);
+        job_ring_destroy(&pool->lanes[c].ring);
     }
-
-    pthread_mutex_destroy(&pool->mutex);
-    pthread_cond_destroy(&pool->cond_jobs);
-    pthread_cond_destroy(&pool->cond_empty);
-    job_queue_destroy(&pool->queue);
-    std::free(pool->threads);
+    std::free(pool->workers);
     std::free(pool);
 }
 
+// Claims a unit of the class's capacity; fails when it already holds
+// capacity jobs. A CAS rather than add-then-undo, so a failed attempt never
+// makes the class look fuller than it is to a concurrent submitter.
+static int reserve_slot(thread_pool_t *pool, tp_class_t cls) {
+    lane_t *lane = &pool->lanes[cls];
+    size_t q = __atomic_load_n(&lane->queued, __ATOMIC_SEQ_CST);
+    do {
+        if (q >= pool->capacity) {
+            return -1;
+        }
+    } while (!__atomic_compare_exchange_n(&lane->queued, &q, q + 1, true, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+    __atomic_add_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+// Cannot fail: every class queue holds at least capacity jobs, and no more
+// than that are ever reserved per class. The ring can still refuse a push
+// for a moment: a consumer that claimed the cell one lap earlier may not have
+// released it yet, so retry until it has.
+static void lane_push(thread_pool_t *pool, tp_job_t job) {
+    lane_t *lane = &pool->lanes[job.cls];
+    if (pool->queue == TP_QUEUE_MPMC) {
+        while (job_ring_push(&lane->ring, job) != 0) {
+            sched_yield();
+        }
+        return;
+    }
+    pthread_mutex_lock(&lane->lock);
+    job_queue_push(&lane->inject, job);
+    __atomic_store_n(&lane->inject_size, lane->inject.size, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&lane->lock);
+}
+
+// Publishes a job whose slot is reserved: an interactive job submitted by a
+// worker of this pool goes onto that worker's own deque, anything else into
+// its class queue.
+static void publish(thread_pool_t *pool, tp_job_t job) {
+    worker_t *self = tp_self;
+    if (job.cls != TP_CLASS_INTERACTIVE || !self || self->pool != pool || deque_push(self, job) != 0) {
+        lane_push(pool, job);
+    }
+    wake_worker(pool, job.cls);
+}
+
 int thread_pool_submit(thread_pool_t *pool, tp_job_t job) {
-    if (!pool || !job.fn) {
+    if (!pool || !job.fn || (unsigned)job.cls >= TP_CLASS_COUNT) {
         errno = EINVAL;
         return -1;
     }
 
-    pthread_mutex_lock(&pool->mutex);
-    while (!pool->shutting_down && pool->queue.size == pool->queue.capacity) {
-        pthread_cond_wait(&pool->cond_empty, &pool->mutex);
+    for (;;) {
+        if (__atomic_load_n(&pool->shutting_down, __ATOMIC_ACQUIRE)) {
+            errno = ECANCELED;
+            return -1;
+        }
+        uint32_t seq = __atomic_load_n(&pool->space_seq, __ATOMIC_ACQUIRE);
+        __atomic_add_fetch(&pool->space_waiters, 1, __ATOMIC_SEQ_CST);
+        int rc = reserve_slot(pool, job.cls);
+        if (rc != 0 && !__atomic_load_n(&pool->shutting_down, __ATOMIC_ACQUIRE)) {
+            futex_wait(&pool->space_seq, seq);
+        }
+        __atomic_sub_fetch(&pool->space_waiters, 1, __ATOMIC_SEQ_CST);
+        if (rc == 0) {
+            break;
+        }
+    }
+    publish(pool, job);
+    return 0;
+}
+
+int thread_pool_try_submit(thread_pool_t *pool, tp_job_t job) {
+    if (!pool || !job.fn || (unsigned)job.cls >= TP_CLASS_COUNT) {
+        errno = EINVAL;
+        return -1;
     }
-    if (pool->shutting_down) {
-        pthread_mutex_unlock(&pool->mutex);
+    if (__atomic_load_n(&pool->shutting_down, __ATOMIC_ACQUIRE)) {
         errno = ECANCELED;
         return -1;
     }
-
-    int rc = job_queue_push(&pool->queue, job);
-    if (rc != 0) {
-        if (pool->on_error) pool->on_error("job queue overflow");
-        pthread_mutex_unlock(&pool->mutex);
+    if (reserve_slot(pool, job.cls) != 0) {
         errno = EAGAIN;
         return -1;
     }
-    pthread_cond_signal(&pool->cond_jobs);
-    pthread_mutex_unlock(&pool->mutex);
+    publish(pool, job);
     return 0;
 }
 
+uint64_t thread_pool_wait_estimate_us(thread_pool_t *pool, tp_class_t cls, size_t ahead) {
+    if (!pool || (unsigned)cls >= TP_CLASS_COUNT) return 0;
+    lane_t *lane = &pool->lanes[cls];
+    size_t queued = __atomic_load_n(&lane->queued, __ATOMIC_RELAXED) + ahead;
+    uint64_t avg = __atomic_load_n(&lane->avg_job_ns, __ATOMIC_RELAXED);
+    size_t workers = cls == TP_CLASS_INTERACTIVE ? pool->thread_count : pool->thread_count - pool->reserved;
+    return (uint64_t)queued * avg / workers / 1000;
+}
+
 size_t thread_pool_size(const thread_pool_t *pool) {
     if (!pool) return 0;
     return pool->thread_count;
@@ -0,0 +1,168 @@
+#include "timer_wheel.h"
+
+#include <cstring>
+
+#define TW_L0_MASK (TW_L0_SLOTS - 1)
+#define TW_L1_MASK (TW_L1_SLOTS - 1)
+#define TW_SPAN ((uint64_t)TW_L0_SLOTS * TW_L1_SLOTS)
+
+static void slot_init(timer_node_t *head) {
+    head->prev = head->next = head;
+    head->armed = 0;
+    head->data = NULL;
+}
+
+static int slot_empty(const timer_node_t *head) {
+    return head->next == head;
+}
+
+// A node can always find its slot again from expires_tick, so unlinking does
+// not need a back-pointer: the slot is empty afterwards iff its neighbours
+// are both the sentinel.
+static void clear_bit_if_empty(timer_wheel_t *w, timer_node_t *head) {
+    if (!slot_empty(head)) return;
+    if (head >= w->l0 && head < w->l0 + TW_L0_SLOTS) {
+        size_t idx = (size_t)(head - w->l0);
+        w->l0_bitmap[idx >> 6] &= ~(1ULL << (idx & 63));
+    } else {
+        size_t idx = (size_t)(head - w->l1);
+        w->l1_bitmap &= ~(1ULL << idx);
+    }
+}
+
+static void unlink_node(timer_wheel_t *w, timer_node_t *node) {
+    timer_node_t *prev = node->prev;
+    timer_node_t *next = node->next;
+    prev->next = next;
+    next->prev = prev;
+    node->prev = node->next = NULL;
+    node->armed = 0;
+    w->count--;
+    // One of the neighbours is the sentinel when the slot just became empty.
+    if (prev == next) {
+        clear_bit_if_empty(w, prev);
+    }
+}
+
+static void place(timer_wheel_t *w, timer_node_t *node) {
+    uint64_t delta = node->expires_tick - w->current_tick;
+    timer_node_t *head;
+    if (delta < TW_L0_SLOTS) {
+        size_t idx = (size_t)(node->expires_tick & TW_L0_MASK);
+        head = &w->l0[idx];
+        w->l0_bitmap[idx >> 6] |= 1ULL << (idx & 63);
+    } else {
+        // Beyond the wheel's span: park in the farthest slot and let the
+        // cascade re-place it by its real expiry.
+        uint64_t tick = delta < TW_SPAN ? node->expires_tick : w->current_tick + TW_SPAN - 1;
+        size_t idx = (size_t)((tick >> TW_L0_BITS) & TW_L1_MASK);
+        head = &w->l1[idx];
+        w->l1_bitmap |= 1ULL << idx;
+    }
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+    node->armed = 1;
+    w->count++;
+}
+
+static void cascade(timer_wheel_t *w) {
+    size_t idx = (size_t)((w->current_tick >> TW_L0_BITS) & TW_L1_MASK);
+    timer_node_t *head = &w->l1[idx];
+    while (!slot_empty(head)) {
+        timer_node_t *node = head->next;
+        unlink_node(w, node);
+        place(w, node);
+    }
+}
+
+void timer_wheel_init(timer_wheel_t *w, long long now_ms, long long tick_ms) {
+    memset(w, 0, sizeof(*w));
+    w->origin_ms = now_ms;
+    w->tick_ms = tick_ms > 0 ? tick_ms : 1;
+    for (size_t i = 0; i < TW_L0_SLOTS; ++i) slot_init(&w->l0[i]);
+    for (size_t i = 0; i < TW_L1_SLOTS; ++i) slot_init(&w->l1[i]);
+}
+
+void timer_node_init(timer_node_t *node, void *data) {
+    memset(node, 0, sizeof(*node));
+    node->data = data;
+}
+
+void timer_wheel_schedule(timer_wheel_t *w, timer_node_t *node, long long expires_ms) {
+    if (node->armed) {
+        unlink_node(w, node);
+    }
+    uint64_t tick = 0;
+    if (expires_ms > w->origin_ms) {
+        tick = (uint64_t)((expires_ms - w->origin_ms + w->tick_ms - 1) / w->tick_ms);
+    }
+    if (tick <= w->current_tick) {
+        tick = w->current_tick + 1;
+    }
+    node->expires_ms = expires_ms;
+    node->expires_tick = tick;
+    place(w, node);
+}
+
+void timer_wheel_cancel(timer_wheel_t *w, timer_node_t *node) {
+    if (node->armed) {
+        unlink_node(w, node);
+    }
+}
+
+void timer_wheel_advance(timer_wheel_t *w, long long now_ms, timer_expire_fn fn, void *ctx) {
+    if (now_ms < w->origin_ms) return;
+    uint64_t target = (uint64_t)((now_ms - w->origin_ms) / w->tick_ms);
+    while (w->current_tick < target) {
+        if (w->count == 0) {
+            w->current_tick = target;
+            break;
+        }
+        w->current_tick++;
+        if ((w->current_tick & TW_L0_MASK) == 0) {
+            cascade(w);
+        }
+        timer_node_t *head = &w->l0[w->current_tick & TW_L0_MASK];
+        while (!slot_empty(head)) {
+            timer_node_t *node = head->next;
+            unlink_node(w, node);
+            fn(node, ctx);
+        }
+    }
+}
+
+int timer_wheel_next_timeout(const timer_wheel_t *w, long long now_ms) {
+    if (w->count == 0) return -1;
+
+    // Next occupied level-0 slot, searched a bitmap word at a time.
+    uint64_t next_tick = 0;
+    size_t start = (size_t)((w->current_tick + 1) & TW_L0_MASK);
+    for (size_t n = 0; n < TW_L0_SLOTS;) {
+        size_t slot = (start + n) & TW_L0_MASK;
+        size_t bit = slot & 63;
+        uint64_t bits = w->l0_bitmap[slot >> 6] >> bit;
+        if (bits) {
+            n += (size_t)__builtin_ctzll(bits);
+            if (n < TW_L0_SLOTS) {
+                next_tick = w->current_tick + 1 + n;
+            }
+            break;
+        }
+        n += 64 - bit;
+    }
+    if (w->l1_bitmap) {
+        uint64_t boundary = ((w->current_tick >> TW_L0_BITS) + 1) << TW_L0_BITS;
+        if (next_tick == 0 || boundary < next_tick) {
+            next_tick = boundary;
+        }
+    }
+    if (next_tick == 0) return -1;
+
+    long long due = w->origin_ms + (long long)next_tick * w->tick_ms;
+    long long wait = due - now_ms;
+    if (wait < 0) wait = 0;
+    if (wait > 0x7fffffffLL) wait = 0x7fffffffLL;
+    return (int)wait;
+}
@@ -0,0 +1,738 @@
+#include "reactor.h"
+#include "logger.h"
+#include "util.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// io_uring flavour of the reactor. It keeps the epoll engine's connection_t
+// state machine and router contract, but replaces readiness polling with
+// completions: one multishot accept per listener, one multishot recv per
+// connection fed from a ring of provided buffers, and responses submitted as
+// a single chain of linked sends. No epoll_ctl and no per-read syscall. A
+// connection that may not take input (full pipeline or output backlog) has
+// its recv cancelled and re-armed once it may again.
+
+#define URING_ENTRIES 1024
+#define URING_BUFFER_COUNT 256 // power of two
+#define URING_BUFFER_SIZE 16384
+#define URING_BUFFER_GROUP 0
+#define URING_SEND_CHUNK 65536
+#define URING_RESPONSE_BATCH 64
+
+namespace mail {
+
+namespace {
+
+enum UringOp : uint64_t {
+    URING_OP_ACCEPT = 1,
+    URING_OP_RECV,
+    URING_OP_SEND,
+    URING_OP_WAKE,
+    URING_OP_CANCEL
+};
+
+// user_data layout: op (8 bits) | generation (24 bits) | fd (32 bits). The
+// generation lets late completions for a closed fd be told apart from the
+// connection that reused the number.
+uint64_t pack_user_data(UringOp op, int fd, uint32_t gen) {
+    return (static_cast<uint64_t>(op) << 56) |
+           (static_cast<uint64_t>(gen & 0xffffffu) << 32) |
+           static_cast<uint32_t>(fd);
+}
+
+UringOp user_data_op(uint64_t data) { return static_cast<UringOp>(data >> 56); }
+int user_data_fd(uint64_t data) { return static_cast<int>(data & 0xffffffffu); }
+uint32_t user_data_gen(uint64_t data) { return static_cast<uint32_t>((data >> 32) & 0xffffffu); }
+
+int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0));
+}
+
+int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+template <typename T>
+T load_acquire(const T *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+template <typename T>
+void store_release(T *p, T v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+struct FdState {
+    uint32_t gen{0};
+    uint32_t sends_inflight{0};
+    bool send_failed{false};
+    bool closing{false};
+    bool recv_armed{false};  // a multishot recv is outstanding
+    bool recv_paused{false}; // input is held back; do not re-arm the recv
+    bool send_retry{false};  // on send_retry, waiting for SQ space
+};
+
+} // namespace
+
+struct UringEngine {
+    int ring_fd{-1};
+
+    void *sq_ptr{nullptr};
+    std::size_t sq_len{0};
+    void *cq_ptr{nullptr};
+    std::size_t cq_len{0};
+    struct io_uring_sqe *sqes{nullptr};
+    std::size_t sqes_len{0};
+
+    unsigned *sq_head{nullptr};
+    unsigned *sq_tail{nullptr};
+    unsigned *sq_array{nullptr};
+    unsigned sq_mask{0};
+    unsigned sq_entries{0};
+    unsigned sqe_tail{0};
+    unsigned sqe_submitted{0};
+
+    unsigned *cq_head{nullptr};
+    unsigned *cq_tail{nullptr};
+    unsigned cq_mask{0};
+    struct io_uring_cqe *cqes{nullptr};
+
+    struct io_uring_buf_ring *buf_ring{nullptr};
+    std::size_t buf_ring_len{0};
+    char *buffers{nullptr};
+    uint16_t buf_tail{0};
+
+    uint64_t wake_value{0};
+    std::vector<FdState> fds;
+    // Connections whose output could not get a single SQE; retried each turn.
+    std::vector<int> send_retry;
+};
+
+namespace {
+
+// Submits queued SQEs and, when wait_nr > 0, waits for completions for at
+// most timeout_ms (negative: no limit), like epoll_wait.
+int engine_submit(UringEngine *e, unsigned wait_nr, int timeout_ms = -1) {
+    unsigned to_submit = e->sqe_tail - e->sqe_submitted;
+    store_release(e->sq_tail, e->sqe_tail);
+    unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+    int rc;
+    if (wait_nr && timeout_ms >= 0) {
+        struct __kernel_timespec ts;
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+        struct io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+        rc = static_cast<int>(syscall(__NR_io_uring_enter, e->ring_fd, to_submit, wait_nr,
+                                      flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg)));
+    } else {
+        rc = sys_io_uring_enter(e->ring_fd, to_submit, wait_nr, flags);
+    }
+    if (rc < 0) {
+        if (errno == ETIME) {
+            e->sqe_submitted += to_submit;
+            return 0;
+        }
+        return -errno;
+    }
+    e->sqe_submitted += static_cast<unsigned>(rc);
+    return rc;
+}
+
+unsigned engine_sq_space(UringEngine *e) {
+    return e->sq_entries - (e->sqe_tail - load_acquire(e->sq_head));
+}
+
+struct io_uring_sqe *engine_get_sqe(UringEngine *e) {
+    unsigned head = load_acquire(e->sq_head);
+    if (e->sqe_tail - head >= e->sq_entries) {
+        engine_submit(e, 0);
+        head = load_acquire(e->sq_head);
+        if (e->sqe_tail - head >= e->sq_entries) {
+            return nullptr;
+        }
+    }
+    unsigned idx = e->sqe_tail & e->sq_mask;
+    struct io_uring_sqe *sqe = &e->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    e->sq_array[idx] = idx;
+    e->sqe_tail++;
+    return sqe;
+}
+
+FdState &fd_state(UringEngine *e, int fd) {
+    const auto idx = static_cast<std::size_t>(fd);
+    if (idx >= e->fds.size()) {
+        e->fds.resize(idx + 1024);
+    }
+    return e->fds[idx];
+}
+
+void recycle_buffer(UringEngine *e, uint16_t bid) {
+    const unsigned mask = URING_BUFFER_COUNT - 1;
+    // Index by hand: in C++ the kernel's flex-array macro adds a padding
+    // member in front of bufs[], which would shift every entry.
+    struct io_uring_buf *buf = reinterpret_cast<struct io_uring_buf *>(e->buf_ring) + (e->buf_tail & mask);
+    buf->addr = reinterpret_cast<uint64_t>(e->buffers + static_cast<std::size_t>(bid) * URING_BUFFER_SIZE);
+    buf->len = URING_BUFFER_SIZE;
+    buf->bid = bid;
+    e->buf_tail++;
+    store_release(&e->buf_ring->tail, e->buf_tail);
+}
+
+void arm_accept(Reactor *r) {
+    struct io_uring_sqe *sqe = engine_get_sqe(r->uring);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = r->listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = pack_user_data(URING_OP_ACCEPT, r->listen_fd, 0);
+}
+
+void arm_wake(Reactor *r) {
+    struct io_uring_sqe *sqe = engine_get_sqe(r->uring);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = r->event_fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&r->uring->wake_value);
+    sqe->len = sizeof(r->uring->wake_value);
+    sqe->user_data = pack_user_data(URING_OP_WAKE, r->event_fd, 0);
+}
+
+void arm_recv(Reactor *r, int fd) {
+    FdState &st = fd_state(r->uring, fd);
+    struct io_uring_sqe *sqe = engine_get_sqe(r->uring);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = pack_user_data(URING_OP_RECV, fd, st.gen);
+    st.recv_armed = true;
+}
+
+// Stops taking input off a connection that may not parse any more: the
+// recv is cancelled, and bytes it already received are still appended. The
+// cancel is submitted right away; until it runs, the recv keeps filling
+// provided buffers.
+void pause_recv(Reactor *r, int fd) {
+    FdState &st = fd_state(r->uring, fd);
+    if (st.recv_paused || !st.recv_armed) return;
+    struct io_uring_sqe *sqe = engine_get_sqe(r->uring);
+    if (!sqe) return; // tried again with the next completion
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = pack_user_data(URING_OP_RECV, fd, st.gen);
+    sqe->user_data = pack_user_data(URING_OP_CANCEL, fd, st.gen);
+    st.recv_paused = true;
+    engine_submit(r->uring, 0);
+}
+
+// Re-arms the recv of a paused connection once the pipeline or its output
+// has drained. If the cancelled recv has not completed yet, its completion
+// re-arms instead.
+void resume_recv(Reactor *r, connection_t *conn) {
+    FdState &st = fd_state(r->uring, conn->fd);
+    if (!st.recv_paused || st.closing || !reactor_wants_input(r, conn)) return;
+    st.recv_paused = false;
+    if (!st.recv_armed) {
+        arm_recv(r, conn->fd);
+    }
+}
+
+// Queues the unsent output segments as linked sends, large ones split into
+// URING_SEND_CHUNK pieces. MSG_WAITALL makes a short send retry inside the
+// kernel, so the chain either goes out in order or breaks with an error and
+// the rest completes with -ECANCELED. The chain only takes SQ slots that are
+// free, so it is never split by a submit in its middle; segments beyond it
+// (or beyond OUT_QUEUE_IOV_MAX) go out with the next chain. With no slot at
+// all the connection waits on send_retry for the next loop turn.
+void start_send(Reactor *r, connection_t *conn) {
+    UringEngine *e = r->uring;
+    FdState &st = fd_state(e, conn->fd);
+    struct iovec iov[OUT_QUEUE_IOV_MAX];
+    const std::size_t count = out_queue_iov(&conn->out, iov, OUT_QUEUE_IOV_MAX);
+    std::size_t needed = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        needed += (iov[i].iov_len + URING_SEND_CHUNK - 1) / URING_SEND_CHUNK;
+    }
+    if (engine_sq_space(e) < needed) {
+        engine_submit(e, 0); // nothing of this chain is queued yet
+    }
+    std::size_t budget = engine_sq_space(e);
+    if (budget == 0) {
+        if (st.sends_inflight == 0 && !st.send_retry) {
+            st.send_retry = true; // on_send resumes otherwise
+            e->send_retry.push_back(conn->fd);
+        }
+        return;
+    }
+    struct io_uring_sqe *prev = nullptr;
+    for (std::size_t i = 0; i < count && budget > 0; ++i) {
+        const char *data = static_cast<const char *>(iov[i].iov_base);
+        std::size_t remaining = iov[i].iov_len;
+        while (remaining > 0 && budget > 0) {
+            struct io_uring_sqe *sqe = engine_get_sqe(e);
+            if (!sqe) {
+                return;
+            }
+            budget--;
+            if (prev) {
+                prev->flags |= IOSQE_IO_LINK;
+            }
+            std::size_t chunk = remaining < URING_SEND_CHUNK ? remaining : URING_SEND_CHUNK;
+            sqe->opcode = IORING_OP_SEND;
+            sqe->fd = conn->fd;
+            sqe->addr = reinterpret_cast<uint64_t>(data);
+            sqe->len = static_cast<uint32_t>(chunk);
+            sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+            sqe->user_data = pack_user_data(URING_OP_SEND, conn->fd, st.gen);
+            data += chunk;
+            remaining -= chunk;
+            prev = sqe;
+            st.sends_inflight++;
+        }
+    }
+}
+
+// Drops a connection. In-flight sends still point into its output, so the
+// socket is only shut down here and the connection freed by the last send
+// completion. Shutting down also ends the pending multishot recv.
+void close_connection(Reactor *r, ConnectionTable &table, int fd) {
+    FdState &st = fd_state(r->uring, fd);
+    if (connection_t *conn = table.get(fd)) {
+        reactor_forget(r, conn);
+    }
+    shutdown(fd, SHUT_RDWR);
+    if (st.sends_inflight > 0) {
+        st.closing = true;
+        if (connection_t *conn = table.get(fd)) {
+            conn->state = CONN_STATE_CLOSING;
+        }
+        return;
+    }
+    st.closing = false;
+    table.erase(fd);
+}
+
+// The output's staging buffer may only grow while no send points into it, so
+// responses that complete during a send wait in the reorder queue for its
+// completion.
+void flush_responses(Reactor *r, connection_t *conn) {
+    if (fd_state(r->uring, conn->fd).sends_inflight == 0 && reactor_flush_responses(r, conn)) {
+        start_send(r, conn);
+    }
+}
+
+// Parses what is buffered and sends what is ready. Staging responses frees
+// pipeline slots, so buffered requests get them before the recv may resume.
+void consume_input(Reactor *r, connection_t *conn) {
+    reactor_consume_input(r, conn);
+    flush_responses(r, conn);
+    if (reactor_wants_input(r, conn)) {
+        reactor_consume_input(r, conn);
+        flush_responses(r, conn);
+    }
+    resume_recv(r, conn);
+}
+
+// Sends output that found the SQ full when it was staged.
+void retry_sends(Reactor *r, ConnectionTable &table) {
+    UringEngine *e = r->uring;
+    std::vector<int> fds;
+    fds.swap(e->send_retry);
+    for (int fd : fds) {
+        FdState &st = fd_state(e, fd);
+        st.send_retry = false;
+        connection_t *conn = table.get(fd);
+        if (conn && !st.closing && st.sends_inflight == 0 && out_queue_pending(&conn->out) > 0) {
+            start_send(r, conn);
+        }
+    }
+}
+
+void on_accept(Reactor *r, ConnectionTable &table, const struct io_uring_cqe *cqe) {
+    if (cqe->res >= 0) {
+        int client_fd = cqe->res;
+        FdState &st = fd_state(r->uring, client_fd);
+        st.gen++;
+        st.sends_inflight = 0;
+        st.send_failed = false;
+        st.closing = false;
+        st.recv_armed = false;
+        st.recv_paused = false;
+        int victim = reactor_adopt_connection(r, table, client_fd);
+        if (victim >= 0) {
+            close_connection(r, table, victim);
+        }
+        arm_recv(r, client_fd);
+    } else if (cqe->res != -EAGAIN && cqe->res != -EINTR) {
+        LOGE("accept error: %s", strerror(-cqe->res));
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        arm_accept(r);
+    }
+}
+
+void on_recv(Reactor *r, ConnectionTable &table, const struct io_uring_cqe *cqe) {
+    UringEngine *e = r->uring;
+    const int fd = user_data_fd(cqe->user_data);
+    const char *data = nullptr;
+    uint16_t bid = 0;
+    const bool has_buffer = (cqe->flags & IORING_CQE_F_BUFFER) != 0;
+    if (has_buffer) {
+        bid = static_cast<uint16_t>(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        data = e->buffers + static_cast<std::size_t>(bid) * URING_BUFFER_SIZE;
+    }
+
+    FdState &st = fd_state(e, fd);
+    connection_t *conn = table.get(fd);
+    if (!conn || st.gen != user_data_gen(cqe->user_data) || st.closing) {
+        if (has_buffer) recycle_buffer(e, bid);
+        return;
+    }
+    const bool more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+    if (!more) {
+        st.recv_armed = false;
+    }
+
+    if (cqe->res > 0 && has_buffer) {
+        int rc = buffer_pool_attach(conn->pool, &conn->read_buf, READ_BUFFER_SIZE);
+        if (rc == 0) {
+            rc = buffer_append(&conn->read_buf, data, static_cast<std::size_t>(cqe->res));
+        }
+        recycle_buffer(e, bid);
+        if (rc != 0) {
+            close_connection(r, table, fd);
+            return;
+        }
+        conn->last_activity_ms = util_now_ms();
+        consume_input(r, conn);
+        reactor_touch(r, conn);
+        if (!reactor_wants_input(r, conn)) {
+            pause_recv(r, fd);
+        }
+    } else {
+        if (has_buffer) recycle_buffer(e, bid);
+        if (cqe->res != -ENOBUFS && cqe->res != -ECANCELED) {
+            close_connection(r, table, fd); // peer closed or hard error
+            return;
+        }
+    }
+
+    if (!more && !st.recv_paused) {
+        if (reactor_wants_input(r, conn)) {
+            arm_recv(r, fd);
+        } else {
+            st.recv_paused = true;
+        }
+    }
+}
+
+void on_send(Reactor *r, ConnectionTable &table, const struct io_uring_cqe *cqe) {
+    const int fd = user_data_fd(cqe->user_data);
+    FdState &st = fd_state(r->uring, fd);
+    if (st.gen != user_data_gen(cqe->user_data)) {
+        return;
+    }
+    if (st.sends_inflight > 0) {
+        st.sends_inflight--;
+    }
+    connection_t *conn = table.get(fd);
+    if (!conn) {
+        return;
+    }
+    if (cqe->res > 0) {
+        out_queue_consume(&conn->out, static_cast<std::size_t>(cqe->res));
+    }
+    if (cqe->res < 0 && cqe->res != -ECANCELED) {
+        st.send_failed = true;
+    }
+    if (st.sends_inflight > 0) {
+        return;
+    }
+    if (st.closing || st.send_failed) {
+        st.send_failed = false;
+        close_connection(r, table, fd);
+        return;
+    }
+    conn->last_activity_ms = util_now_ms();
+    if (out_queue_pending(&conn->out) > 0) {
+        start_send(r, conn); // the chain broke early or was capped; resume
+        reactor_touch(r, conn);
+        return;
+    }
+    // The output is drained, so this only performs the state transition.
+    if (connection_handle_write(conn) < 0 || conn->state == CONN_STATE_CLOSING) {
+        close_connection(r, table, fd);
+        return;
+    }
+    consume_input(r, conn);
+    reactor_touch(r, conn);
+}
+
+// Applies worker responses in batches and then flushes every connection that
+// got any once, so a burst for one client becomes one chain of sends. Each
+// response frees a pipeline slot, so input held back by pipeline_depth is
+// parsed too: a response the worker wrote itself brings no send completion
+// that would do it.
+void drain_responses(Reactor *r, ConnectionTable &table) {
+    worker_response_t *batch[URING_RESPONSE_BATCH];
+    connection_t *touched[URING_RESPONSE_BATCH];
+    std::size_t n;
+    while ((n = reactor_take_responses(r, batch, URING_RESPONSE_BATCH)) > 0) {
+        std::size_t touched_count = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            std::unique_ptr<worker_response_t> resp(batch[i]);
+            if (fd_state(r->uring, CONN_ID_FD(resp->conn_id)).closing) {
+                continue; // its output still backs in-flight sends
+            }
+            connection_t *conn = reactor_apply_response(r, table, resp.get());
+            if (!conn) {
+                continue;
+            }
+            resp.release();
+            if (!conn->in_batch) {
+                conn->in_batch = 1;
+                touched[touched_count++] = conn;
+            }
+        }
+        for (std::size_t i = 0; i < touched_count; ++i) {
+            touched[i]->in_batch = 0;
+            consume_input(r, touched[i]);
+        }
+    }
+}
+
+void on_wake(Reactor *r) {
+    arm_wake(r); // the responses themselves are drained once per loop turn
+}
+
+// Kernels that have provided-buffer rings but predate multishot recv (5.19)
+// reject it with -EINVAL only once it runs, so try one on a socketpair.
+bool probe_multishot_recv(UringEngine *e) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) {
+        return false;
+    }
+    bool ok = false;
+    struct io_uring_sqe *sqe = engine_get_sqe(e);
+    if (sqe && write(sv[1], "x", 1) == 1) {
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = sv[0];
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_BUFFER_GROUP;
+        sqe->user_data = pack_user_data(URING_OP_RECV, sv[0], 0);
+        bool armed = true;
+        // The first completion carries the byte; shutting the socket down
+        // then ends the recv, whose last completion has no F_MORE.
+        for (int round = 0; armed && round < 2; ++round) {
+            if (engine_submit(e, 1, 1000) < 0 || load_acquire(e->cq_tail) == *e->cq_head) {
+                break;
+            }
+            unsigned head = *e->cq_head;
+            const struct io_uring_cqe *cqe = &e->cqes[head & e->cq_mask];
+            if (cqe->flags & IORING_CQE_F_BUFFER) {
+                recycle_buffer(e, static_cast<uint16_t>(cqe->flags >> IORING_CQE_BUFFER_SHIFT));
+            }
+            if (round == 0) {
+                ok = cqe->res == 1 && (cqe->flags & IORING_CQE_F_MORE);
+            }
+            armed = (cqe->flags & IORING_CQE_F_MORE) != 0;
+            store_release(e->cq_head, head + 1);
+            if (round == 0) {
+                shutdown(sv[0], SHUT_RDWR);
+            }
+        }
+        ok = ok && !armed;
+    }
+    close(sv[0]);
+    close(sv[1]);
+    return ok;
+}
+
+void engine_destroy(UringEngine *e) {
+    if (e->ring_fd >= 0) close(e->ring_fd);
+    if (e->buf_ring) munmap(e->buf_ring, e->buf_ring_len);
+    std::free(e->buffers);
+    if (e->sqes) munmap(e->sqes, e->sqes_len);
+    if (e->cq_ptr && e->cq_ptr != e->sq_ptr) munmap(e->cq_ptr, e->cq_len);
+    if (e->sq_ptr) munmap(e->sq_ptr, e->sq_len);
+    delete e;
+}
+
+} // namespace
+
+int uring_engine_setup(Reactor *r) {
+    auto *e = new UringEngine{};
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = URING_ENTRIES * 4; // multishot ops post many CQEs per SQE
+    e->ring_fd = sys_io_uring_setup(URING_ENTRIES, &p);
+    if (e->ring_fd < 0) {
+        LOGW("io_uring_setup failed: %s", strerror(errno));
+        engine_destroy(e);
+        return -1;
+    }
+    util_set_cloexec(e->ring_fd);
+    if (!(p.features & IORING_FEAT_EXT_ARG)) {
+        LOGW("io_uring lacks IORING_FEAT_EXT_ARG, timers would not fire");
+        engine_destroy(e);
+        return -1;
+    }
+
+    e->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    e->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (e->cq_len > e->sq_len) e->sq_len = e->cq_len;
+        e->cq_len = e->sq_len;
+    }
+    e->sq_ptr = mmap(NULL, e->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     e->ring_fd, IORING_OFF_SQ_RING);
+    if (e->sq_ptr == MAP_FAILED) {
+        e->sq_ptr = nullptr;
+        engine_destroy(e);
+        return -1;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        e->cq_ptr = e->sq_ptr;
+    } else {
+        e->cq_ptr = mmap(NULL, e->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         e->ring_fd, IORING_OFF_CQ_RING);
+        if (e->cq_ptr == MAP_FAILED) {
+            e->cq_ptr = nullptr;
+            engine_destroy(e);
+            return -1;
+        }
+    }
+    e->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(NULL, e->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      e->ring_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        engine_destroy(e);
+        return -1;
+    }
+    e->sqes = static_cast<struct io_uring_sqe *>(sqes);
+
+    char *sq = static_cast<char *>(e->sq_ptr);
+    e->sq_head = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+    e->sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+    e->sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+    e->sq_mask = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+    e->sq_entries = p.sq_entries;
+    e->sqe_tail = e->sqe_submitted = *e->sq_tail;
+
+    char *cq = static_cast<char *>(e->cq_ptr);
+    e->cq_head = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+    e->cq_tail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+    e->cq_mask = *reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+    e->cqes = reinterpret_cast<struct io_uring_cqe *>(cq + p.cq_off.cqes);
+
+    // Provided-buffer ring: recv picks a buffer only when data arrives, so
+    // idle connections pin no receive memory inside the kernel.
+    e->buf_ring_len = URING_BUFFER_COUNT * sizeof(struct io_uring_buf);
+    void *ring_mem = mmap(NULL, e->buf_ring_len, PROT_READ | PROT_WRITE,
+                          MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    e->buffers = static_cast<char *>(std::malloc(static_cast<std::size_t>(URING_BUFFER_COUNT) * URING_BUFFER_SIZE));
+    if (ring_mem == MAP_FAILED || !e->buffers) {
+        if (ring_mem != MAP_FAILED) munmap(ring_mem, e->buf_ring_len);
+        engine_destroy(e);
+        return -1;
+    }
+    e->buf_ring = static_cast<struct io_uring_buf_ring *>(ring_mem);
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(e->buf_ring);
+    reg.ring_entries = URING_BUFFER_COUNT;
+    reg.bgid = URING_BUFFER_GROUP;
+    if (sys_io_uring_register(e->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        LOGW("io_uring provided buffer ring unsupported: %s", strerror(errno));
+        engine_destroy(e);
+        return -1;
+    }
+    for (unsigned i = 0; i < URING_BUFFER_COUNT; ++i) {
+        recycle_buffer(e, static_cast<uint16_t>(i));
+    }
+    if (!probe_multishot_recv(e)) {
+        LOGW("io_uring multishot recv unsupported");
+        engine_destroy(e);
+        return -1;
+    }
+
+    r->uring = e;
+    return 0;
+}
+
+void uring_engine_run(Reactor *r, ConnectionTable &table) {
+    UringEngine *e = r->uring;
+    arm_accept(r);
+    arm_wake(r);
+
+    while (1) {
+        int timeout = reactor_next_timeout(r);
+        if (timeout != 0 && !reactor_prepare_wait(r)) {
+            timeout = 0;
+        }
+        int rc = engine_submit(e, 1, timeout);
+        reactor_end_wait(r);
+        if (rc < 0 && rc != -EINTR && rc != -EBUSY && rc != -EAGAIN) {
+            LOGE("io_uring_enter failed: %s", strerror(-rc));
+            break;
+        }
+        reactor_expire_timers(r, table, close_connection);
+        reactor_drain_overflow(r);
+
+        unsigned head = *e->cq_head;
+        unsigned tail = load_acquire(e->cq_tail);
+        for (; head != tail; ++head) {
+            const struct io_uring_cqe *cqe = &e->cqes[head & e->cq_mask];
+            switch (user_data_op(cqe->user_data)) {
+                case URING_OP_ACCEPT:
+                    on_accept(r, table, cqe);
+                    break;
+                case URING_OP_RECV:
+                    on_recv(r, table, cqe);
+                    break;
+                case URING_OP_SEND:
+                    on_send(r, table, cqe);
+                    break;
+                case URING_OP_WAKE:
+                    on_wake(r);
+                    break;
+                case URING_OP_CANCEL:
+                    break; // the cancelled recv reports on its own
+            }
+        }
+        store_release(e->cq_head, head);
+        drain_responses(r, table);
+        retry_sends(r, table);
+    }
+}
+
+void uring_engine_teardown(Reactor *r) {
+    if (!r->uring) return;
+    engine_destroy(r->uring);
+    r->uring = nullptr;
+}
+
+} // namespace mail
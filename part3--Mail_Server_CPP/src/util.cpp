@@ -12,6 +12,12 @@ long long util_now_ms(void) {
     return (long long)tv.tv_sec * 1000LL + tv.tv_usec / 1000;
 }
 
+uint64_t util_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
 int util_set_nonblocking(int fd) {
     int flags = fcntl(fd, F_GETFL, 0);
     if (flags < 0) return -1;